@@ -29,6 +29,7 @@ LCDlite::LCDlite() {
 	_button_pins[2] = 2;
 	_button_pins[3] = 3;
 	_button_pins[4] = 4;
+	_initStep = LCD_INIT_DONE;
 	// we can't begin() yet :(
 }
 
@@ -67,6 +68,14 @@ void LCDlite::init(uint8_t fourbitmode, uint8_t rs, uint8_t rw, uint8_t enable,
 }
 
 void LCDlite::begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
+	start(cols, lines, dotsize);
+	while (!poll())
+		;
+}
+
+// Set up the expander and start the init sequence, which poll() runs
+// without blocking on the HD44780's waits
+void LCDlite::start(uint8_t cols, uint8_t lines, uint8_t dotsize) {
 	// check if i2c
 	if (_i2cAddr != 255) {
 		//_i2c.begin(_i2cAddr);
@@ -106,64 +115,90 @@ void LCDlite::begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
 	// SEE PAGE 45/46 FOR INITIALIZATION SPECIFICATION!
 	// according to datasheet, we need at least 40ms after power rises above 2.7V
 	// before sending commands. Arduino can turn on way befer 4.5V so we'll wait 50
-	delayMicroseconds(50000); 
-	// Now we pull both RS and R/W low to begin commands
-	_digitalWrite(_rs_pin, LOW);
-	_digitalWrite(_enable_pin, LOW);
-	if (_rw_pin != 255) { 
-		_digitalWrite(_rw_pin, LOW);
-	}
+	_initStep = 0;
+	_initWait = 50000;
+	_initAt = micros();
+}
 
-	//put the LCD into 4 bit or 8 bit mode
-	if (! (_displayfunction & LCD_8BITMODE)) {
-		// this is according to the hitachi HD44780 datasheet
-		// figure 24, pg 46
+// Run the next init step once the last one's wait is over, returns true
+// when the display is ready
+bool LCDlite::poll() {
+	if (_initStep == LCD_INIT_DONE)
+		return true;
+	if (micros() - _initAt < _initWait)
+		return false;
+
+	switch (_initStep++) {
+	case 0:
+		// Now we pull both RS and R/W low to begin commands
+		_digitalWrite(_rs_pin, LOW);
+		_digitalWrite(_enable_pin, LOW);
+		if (_rw_pin != 255) { 
+			_digitalWrite(_rw_pin, LOW);
+		}
 
-		// we start in 8bit mode, try to set 4 bit mode
-		write4bits(0x03);
-		delayMicroseconds(4500); // wait min 4.1ms
+		//put the LCD into 4 bit or 8 bit mode
+		if (! (_displayfunction & LCD_8BITMODE)) {
+			// this is according to the hitachi HD44780 datasheet
+			// figure 24, pg 46
 
-		// second try
-		write4bits(0x03);
-		delayMicroseconds(4500); // wait min 4.1ms
+			// we start in 8bit mode, try to set 4 bit mode
+			write4bits(0x03);
+		} else {
+			// this is according to the hitachi HD44780 datasheet
+			// page 45 figure 23
 
+			// Send function set command sequence
+			command(LCD_FUNCTIONSET | _displayfunction);
+		}
+		_initWait = 4500; // wait min 4.1ms
+		break;
+	case 1:
+		// second try
+		if (! (_displayfunction & LCD_8BITMODE)) {
+			write4bits(0x03);
+			_initWait = 4500; // wait min 4.1ms
+		} else {
+			command(LCD_FUNCTIONSET | _displayfunction);
+			_initWait = 150;
+		}
+		break;
+	case 2:
 		// third go!
-		write4bits(0x03); 
-		delayMicroseconds(150);
-
+		if (! (_displayfunction & LCD_8BITMODE)) {
+			write4bits(0x03); 
+			_initWait = 150;
+		} else {
+			command(LCD_FUNCTIONSET | _displayfunction);
+			_initWait = 0;
+		}
+		break;
+	case 3:
 		// finally, set to 8-bit interface
-		write4bits(0x02); 
-	} else {
-		// this is according to the hitachi HD44780 datasheet
-		// page 45 figure 23
-
-		// Send function set command sequence
-		command(LCD_FUNCTIONSET | _displayfunction);
-		delayMicroseconds(4500);  // wait more than 4.1ms
-
-		// second try
-		command(LCD_FUNCTIONSET | _displayfunction);
-		delayMicroseconds(150);
-
-		// third go
-		command(LCD_FUNCTIONSET | _displayfunction);
+		if (! (_displayfunction & LCD_8BITMODE))
+			write4bits(0x02); 
+
+		// finally, set # lines, font size, etc.
+		command(LCD_FUNCTIONSET | _displayfunction);  
+
+		// turn the display on with no cursor or blinking default
+		_displaycontrol = LCD_DISPLAYON | LCD_CURSOROFF | LCD_BLINKOFF;  
+		display();
+
+		// clear it off, this command takes a long time!
+		command(LCD_CLEARDISPLAY);
+		_initWait = 2000;
+		break;
+	default:
+		// Initialize to default text direction (for romance languages)
+		_displaymode = LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT;
+		// set the entry mode
+		command(LCD_ENTRYMODESET | _displaymode);
+		_initStep = LCD_INIT_DONE;
+		return true;
 	}
-
-	// finally, set # lines, font size, etc.
-	command(LCD_FUNCTIONSET | _displayfunction);  
-
-	// turn the display on with no cursor or blinking default
-	_displaycontrol = LCD_DISPLAYON | LCD_CURSOROFF | LCD_BLINKOFF;  
-	display();
-
-	// clear it off
-	clear();
-
-	// Initialize to default text direction (for romance languages)
-	_displaymode = LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT;
-	// set the entry mode
-	command(LCD_ENTRYMODESET | _displaymode);
-
+	_initAt = micros();
+	return false;
 }
 
 /********** high level commands, for the user! */
@@ -46,6 +46,9 @@
 #define LCD_5x10DOTS 0x04
 #define LCD_5x8DOTS 0x00
 
+// poll() step once the display is ready
+#define LCD_INIT_DONE 0xFF
+
 // button masks
 #define BUTTON_UP 0x08
 #define BUTTON_DOWN 0x04
@@ -71,6 +74,8 @@ class LCDlite : public Print {
 				uint8_t d4, uint8_t d5, uint8_t d6, uint8_t d7);
 
 		void begin(uint8_t cols, uint8_t rows, uint8_t charsize = LCD_5x8DOTS);
+		void start(uint8_t cols, uint8_t rows, uint8_t charsize = LCD_5x8DOTS);
+		bool poll();
 
 		void clear();
 		void home();
@@ -115,6 +120,10 @@ class LCDlite : public Print {
 		uint8_t _displaymode;
 
 		uint8_t _initialized;
+		// init sequence run by poll(): next step, and its start and wait in us
+		uint8_t _initStep;
+		uint32_t _initAt;
+		uint16_t _initWait;
 
 		uint8_t _numlines,_currline;
 
@@ -0,0 +1,72 @@
+/* BootSequencer.h
+ * James Lyden <james@lyden.org>
+ *
+ * Interleaves device inits that have been split into a start call and a
+ * poll function, so one device's wait is spent on the others and the boot
+ * takes about as long as the slowest init instead of their sum.  Tasks that
+ * depend on another, like a plugin loaded from SD, wait inside their poll.
+ */
+
+#ifndef BootSequencer_h
+#define BootSequencer_h
+
+#include "Arduino.h"
+
+#ifndef BOOT_MAX_TASKS
+#define BOOT_MAX_TASKS        4
+#endif
+
+// Polls one device's init once: 0 while busy, above 0 done, below 0 failed
+typedef int8_t (*BootTask)();
+
+class BootSequencer {
+	public:
+		BootSequencer() : count(0) {}
+
+		// Add the poll of an init already started, returns its index
+		uint8_t add(BootTask task) {
+			if(count == BOOT_MAX_TASKS) return count;
+			tasks[count].poll = task;
+			tasks[count].result = 0;
+			return count++;
+		}
+
+		// Poll each unfinished task once.  Returns 0 while any is busy, 1
+		// once all are done, or -1 - i as soon as task i fails.
+		int8_t poll() {
+			int8_t status = 1;
+
+			for(uint8_t i = 0; i < count; i++) {
+				if(!tasks[i].result) {
+					tasks[i].result = tasks[i].poll();
+					if(tasks[i].result) tasks[i].doneAt = micros();
+				}
+				if(tasks[i].result < 0) return -1 - i;
+				if(!tasks[i].result) status = 0;
+			}
+			return status;
+		}
+
+		// Poll until all are done or one fails, returns as poll()
+		int8_t run() {
+			int8_t status;
+			while(!(status = poll())) ;
+			return status;
+		}
+
+		// What task i's poll last returned
+		int8_t result(uint8_t i) { return tasks[i].result; }
+
+		// micros() when task i finished
+		uint32_t doneAt(uint8_t i) { return tasks[i].doneAt; }
+
+	private:
+		struct {
+			BootTask poll;
+			int8_t result;
+			uint32_t doneAt;
+		} tasks[BOOT_MAX_TASKS];
+		uint8_t count;
+};
+
+#endif // BootSequencer_h
@@ -9,126 +9,382 @@
 #include "SPI.h"
 
 // Init static variable
-uint16_t MidiSynth::spiRate;
-
-// Initialization and powerdown -- vs_init() does the heavy lifting for begin()
-uint8_t  MidiSynth::begin() {
-
-	pinMode(MIDI_DREQ, INPUT);
-	pinMode(MIDI_XCS, OUTPUT);
-	pinMode(MIDI_XDCS, OUTPUT);
-	pinMode(MIDI_RESET, OUTPUT);
-
-	cs_high();  // MIDI_XCS, Init Control Select to deselected
-	dcs_high(); // MIDI_XDCS, Init Data Select to deselected
-	digitalWrite(MIDI_RESET, LOW); // Put VS1053 into hardware reset
+#if USE_MIDI_PROFILE
+uint32_t midiStageStamp[MIDI_STAGE_COUNT];
+#endif
+MidiSynth* MidiSynth::chips;
+uint8_t MidiSynth::cardSelect = SD_SEL;
+MidiSynth* volatile MidiSynth::dreqOwner[MIDI_DREQ_INTS];
+
+MidiSynth::MidiSynth(uint8_t xcs, uint8_t xdcs, uint8_t dreq, uint8_t reset,
+	int8_t dreqInt)
+	: xcsPin(xcs), xdcsPin(xdcs), dreqPin(dreq), resetPin(reset),
+	  dreqInt(dreqInt), sciRate(SPI_CLOCK_DIV16), sdiRate(SPI_CLOCK_DIV16),
+	  queueHead(0), queueTail(0), stalled(false), initState(MIDI_INIT_IDLE),
+	  shadowValid(0) {
+	memset(&queueStats, 0, sizeof(queueStats));
+	next = chips;
+	chips = this;
+}
 
-	uint8_t result = vs_init();
-	if(result) {
-		return result;
+// Let go of DREQ and leave the chip list, so no interrupt follows a pointer
+// to a chip that's gone
+MidiSynth::~MidiSynth() {
+	noInterrupts();
+	detachDreq();
+	for(MidiSynth** p = &chips; *p; p = &(*p)->next) {
+		if(*p == this) {
+			*p = next;
+			break;
+		}
 	}
+	interrupts();
+}
 
-	return 0;
+// Initialization and powerdown -- start() and poll() do the heavy lifting
+// for begin().  The plugin comes from rtmidi.053 on the SD card, or from a
+// table in flash made by extras/plugin2h, which lets the synth start without
+// the card.  Returns 0, or 4 bad SCI_MODE, 5 bad SCI_CLOCKF readback, 6
+// plugin load failed, 7 DREQ timeout.
+uint8_t  MidiSynth::begin(const uint16_t* plugin, uint16_t words) {
+	int8_t result;
+
+	start(plugin, words);
+	while((result = poll()) == MIDI_POLL_BUSY) ;
+	return result == MIDI_POLL_DONE ? 0 : -result;
 }
 
 void MidiSynth::end() {
 
-	cs_high();  // MIDI_XCS, Init Control Select to deselected
-	dcs_high(); // MIDI_XDCS, Init Data Select to deselected
+	detachDreq();
+
+	cs_high();  // XCS, Init Control Select to deselected
+	dcs_high(); // XDCS, Init Data Select to deselected
 
 	// most importantly...
-	digitalWrite(MIDI_RESET, LOW); // Put VS1053 into hardware reset
+	digitalWrite(resetPin, LOW); // Put VS1053 into hardware reset
+	initState = MIDI_INIT_IDLE;
+	shadowValid = 0;
 }
 
-uint8_t MidiSynth::vs_init() {
-	// Reset if not already
-	delay(100); // keep clear of anything prior
-	digitalWrite(MIDI_RESET, LOW); // Shut down VS1053
-	delay(100);
+// Reset the VS1053 and return at once, poll() finishes the init while the
+// chip boots.  A plugin from SD waits in poll() for the card to be mounted,
+// so sd.beginStart() may run alongside.
+void MidiSynth::start(const uint16_t* plugin, uint16_t words) {
+	MIDI_PROFILE(MIDI_STAGE_START);
 
-	// Bring out of reset
-	digitalWrite(MIDI_RESET, HIGH); // Bring up VS1053
+	pinMode(dreqPin, INPUT);
+	pinMode(xcsPin, OUTPUT);
+	pinMode(xdcsPin, OUTPUT);
+	pinMode(resetPin, OUTPUT);
 
-	// set initial mp3's spi to safe rate
-	spiRate = SPI_CLOCK_DIV16; // initial contact with VS10xx at slow rate
-	delay(10);
+	cs_high();  // XCS, Init Control Select to deselected
+	dcs_high(); // XDCS, Init Data Select to deselected
 
-	// Let's check the status of the VS1053
-	int MP3Mode = MidiReadRegister(SCI_MODE);
+	// Reset if not already, the datasheet asks for only 2 XTALI cycles
+	digitalWrite(resetPin, LOW); // Shut down VS1053
+	shadowValid = 0; // the shadows fill again as registers are touched
+	delayMicroseconds(10);
 
-	if(MP3Mode != (SM_LINE1 | SM_SDINEW)) return 4;
+	// Bring out of reset
+	digitalWrite(resetPin, HIGH); // Bring up VS1053
 
-	// Now that we have the VS1053 up and running, increase the internal clock multiplier and up our SPI rate
-	MidiWriteRegister(SCI_CLOCKF, 0x6000); // Set multiplier to 3.0x
-	// Internal clock multiplier is now 3x.
-	// Therefore, max SPI speed is 52MgHz.
-	spiRate = SPI_CLOCK_DIV4; // use safe SPI rate of (16MHz / 4 = 4MHz)
-	delay(10); // settle time
+	// set initial mp3's spi to safe rate
+	sciRate = sdiRate = SPI_CLOCK_DIV16; // initial contact with VS10xx at slow rate
 
-	// test reading after data rate change
-	int MP3Clock = MidiReadRegister(SCI_CLOCKF);
-	if(MP3Clock != 0x6000) return 5;
+	initPlugin = plugin;
+	initWords = words;
+	initState = MIDI_INIT_BOOT;
+	initT0 = millis();
+}
+
+// One step of the init, never waiting on DREQ.  Returns MIDI_POLL_BUSY,
+// MIDI_POLL_DONE, or the begin() error code negated.
+int8_t MidiSynth::poll() {
+	uint8_t error = 0;
+	bool dreq = digitalRead(dreqPin);
+	uint16_t waited = millis() - initT0;
+	bool late = waited > (initState == MIDI_INIT_BOOT ? MIDI_BOOT_TIMEOUT
+		: initState == MIDI_INIT_CLOCK ? MIDI_CLOCK_TIMEOUT
+		: initState == MIDI_INIT_PLUGIN ? MIDI_CARD_TIMEOUT : MIDI_START_TIMEOUT);
+
+	switch(initState) {
+		case MIDI_INIT_BOOT:
+			if(!dreq) break;
+			// Let's check the status of the VS1053
+			if(MidiReadRegister(SCI_MODE) != (SM_LINE1 | SM_SDINEW)) {
+				error = 4;
+				break;
+			}
+			MIDI_PROFILE(MIDI_STAGE_BOOT);
+
+			// Now that we have the VS1053 up and running, increase the internal clock multiplier and up our SPI rate
+			// Set multiplier to 3.0x, the switch is waited for on later polls
+			MidiWriteRegister(SCI_CLOCKF, 0x6000);
+			// Internal clock multiplier is now 3x, so SCI reads take
+			// CLKI/7 = 5.3MHz and SCI writes and SDI CLKI/4 = 9.2MHz.
+			sciRate = sdiRate = SPI_CLOCK_DIV4; // use safe SPI rate of (16MHz / 4 = 4MHz)
+			initState = MIDI_INIT_CLOCK;
+			initT0 = millis();
+			return MIDI_POLL_BUSY;
+
+		case MIDI_INIT_CLOCK:
+			if(!dreq) break; // clock switch done
+			// test reading after data rate change
+			if(MidiReadRegister(SCI_CLOCKF) != 0x6000) {
+				error = 5;
+				break;
+			}
+			calibrate(); // then take the fastest rates that work
+			MIDI_PROFILE(MIDI_STAGE_CLOCK);
+
+			// Volume -25 dB both sides (0 = max volume), and EarSpeaker
+			// 3, the datasheet-recommended setting for realtime MIDI
+			{
+				SciWrite setup[2] = {
+					{SCI_VOL, 25 << 8 | 25},
+					{SCI_MODE, (uint16_t)(shadowRead(SCI_MODE) | SM_EARSPEAKER_LO
+						| SM_EARSPEAKER_HI)}
+				};
+				writeRegisters(setup, 2);
+			}
+			MIDI_PROFILE(MIDI_STAGE_SETUP);
+			initState = MIDI_INIT_PLUGIN;
+			initT0 = millis();
+			return MIDI_POLL_BUSY;
+
+		case MIDI_INIT_PLUGIN:
+			// the card is mounted once its root is open; without one the
+			// plugin can't load
+			if(!initPlugin && !sd.vwd()->isOpen()) {
+				if(late) error = 6;
+				break;
+			}
+			if(initPlugin ? VSLoadUserCode(initPlugin, initWords)
+				: VSLoadUserCode("rtmidi.053")) {
+				error = 6;
+				break;
+			}
+			MIDI_PROFILE(MIDI_STAGE_PLUGIN);
+			initState = MIDI_INIT_START;
+			initT0 = millis();
+			return MIDI_POLL_BUSY;
+
+		case MIDI_INIT_START:
+			// the plugin is running once DREQ comes back
+			if(!dreq) break;
+			MIDI_PROFILE(MIDI_STAGE_READY);
+
+			// drain queued MIDI as DREQ comes back
+			queueHead = queueTail = 0;
+			stalled = false;
+			if(dreqInt >= 0 && dreqInt < MIDI_DREQ_INTS) {
+				dreqOwner[dreqInt] = this;
+				attachInterrupt(dreqInt, dreqInt ? dreqISR1 : dreqISR0, RISING);
+			}
+			initState = MIDI_INIT_DONE;
+			return MIDI_POLL_DONE;
 
-	setVolume(25, 25);	// In -dB, so lower is louder (0 = max volume)
-	setEarSpeaker(3);	// datasheet-recommended setting for realtime MIDI
+		case MIDI_INIT_DONE:
+			return MIDI_POLL_DONE;
 
-	if(VSLoadUserCode("rtmidi.053")) return 6;
+		default:
+			return -7;
+	}
+	if(!error && !late) return MIDI_POLL_BUSY;
+	initState = MIDI_INIT_IDLE;
+	return error ? -error : -7;
+}
 
-	delay(100); // just a good idea to let settle.
+// Next little-endian word of a plugin file, refilling buf when it runs out
+static bool nextWord(SDfile* patch, uint8_t* buf, int16_t* pos, int16_t* len,
+	uint16_t* word) {
 
-	return 0; // indicating all was good.
+	if(*pos + 2 > *len) {
+		*len = patch->read(buf, MIDI_LOAD_BUFFER);
+		*pos = 0;
+		if(*len < 2) return false;
+	}
+	*word = buf[*pos] | buf[*pos + 1] << 8;
+	*pos += 2;
+	return true;
 }
 
-// Load patches into DSP memory from SD card
+// Load patches into DSP memory from SD card.  The file is read a buffer at
+// a time and each record goes to the chip as one SCI multiple write, split
+// only where the buffer has to be refilled.
 uint8_t MidiSynth::VSLoadUserCode(char* fileName){
 
-	union twobyte val;
-	union twobyte addr;
-	union twobyte n;
+	uint8_t buf[MIDI_LOAD_BUFFER];
+	int16_t pos = 0;
+	int16_t len = 0;
+	uint16_t addr;
+	uint16_t n;
+	uint16_t val;
 	SDfile patch;
 
-	if(!digitalRead(MIDI_RESET)) return 3;
+	if(!digitalRead(resetPin)) return 3;
 
 	// Open the file in read mode.
 	if(!patch.open(fileName, O_READ)) return 2;
 	while(1) {
-		if(!patch.read(addr.byte, 2)) break;
-		if(!patch.read(n.byte, 2)) break;
-		if(n.word & 0x8000U) {
-			n.word &= 0x7FFF;
-			if(!patch.read(val.byte, 2)) break;
-			while(n.word--) {
-				MidiWriteRegister(addr.word, val.word);
-			}
-		} else {
-			while(n.word--) {
-				if(!patch.read(val.byte, 2))   break;
-				MidiWriteRegister(addr.word, val.word);
+		if(!nextWord(&patch, buf, &pos, &len, &addr)) break;
+		if(!nextWord(&patch, buf, &pos, &len, &n)) break;
+		if(n & 0x8000U) {
+			// run of one value
+			if(!nextWord(&patch, buf, &pos, &len, &val)) break;
+			MidiWriteRegisters(addr, 0, n & 0x7FFF, val);
+			continue;
+		}
+		while(n) {
+			if(pos + 2 > len) {
+				len = patch.read(buf, MIDI_LOAD_BUFFER);
+				pos = 0;
+				if(len < 2) break;
 			}
+			// as many words as the buffer holds
+			uint16_t k = (len - pos) / 2;
+			if(k > n) k = n;
+			MidiWriteRegisters(addr, buf + pos, k, 0);
+			pos += 2 * k;
+			n -= k;
 		}
+		if(n) break;
 	}
 	patch.close(); // Close out this patch
 	// playing_state = ready;
 	return 0;
 }
 
+// Load patches into DSP memory from a PROGMEM table holding the plugin
+// file's words, copied to RAM a few words per SCI multiple write
+uint8_t MidiSynth::VSLoadUserCode(const uint16_t* plugin, uint16_t words){
+
+	uint8_t buf[32];
+	uint16_t i = 0;
+
+	if(!digitalRead(resetPin)) return 3;
+
+	while(i + 2 <= words) {
+		uint16_t addr = pgm_read_word(plugin + i++);
+		uint16_t n = pgm_read_word(plugin + i++);
+		if(n & 0x8000U) {
+			// run of one value
+			if(i == words) break;
+			MidiWriteRegisters(addr, 0, n & 0x7FFF, pgm_read_word(plugin + i++));
+			continue;
+		}
+		if(n > words - i) n = words - i;
+		while(n) {
+			uint8_t k = n < sizeof(buf) / 2 ? n : sizeof(buf) / 2;
+			for(uint8_t j = 0; j < k; j++) {
+				uint16_t val = pgm_read_word(plugin + i++);
+				buf[2 * j] = val;
+				buf[2 * j + 1] = val >> 8;
+			}
+			MidiWriteRegisters(addr, buf, k, 0);
+			n -= k;
+		}
+	}
+	return 0;
+}
+
+// SCK for a divider from SPI.h
+static uint32_t sckHz(uint8_t rate) {
+	uint8_t div = (rate & SPI_CLOCK_MASK) == 3 ? 128 : 4 << 2 * (rate & SPI_CLOCK_MASK);
+	if((rate >> 2) & SPI_2XCLOCK_MASK) div >>= 1;
+	return F_CPU / div;
+}
+
+// SPI dividers calibrate() tries, fastest first.  The last one is safe at
+// any CLKI.
+static const uint8_t spiDividers[] = {
+	SPI_CLOCK_DIV2, SPI_CLOCK_DIV4, SPI_CLOCK_DIV8, SPI_CLOCK_DIV16
+};
+#define SPI_DIVIDERS (sizeof(spiDividers) / sizeof(spiDividers[0]))
+
+// CLKI from SCI_CLOCKF: XTALI, or SC_FREQ when set, times SC_MULT, which
+// steps 1.0x, 2.0x, 2.5x ... 5.0x
+uint32_t MidiSynth::clkiHz() {
+	uint16_t clockf = shadowRead(SCI_CLOCKF);
+	uint16_t freq = clockf & 0x07FF;
+	uint8_t mult = clockf >> 13;
+	uint32_t xtali = freq ? freq * 4000UL + 8000000UL : MIDI_XTALI;
+
+	return xtali / 2 * (mult ? mult + 3 : 2);
+}
+
+// Find the fastest SPI clocks the chip takes once CLKI is raised.  SCI
+// writes and SDI share a CLKI/4 limit, so each divider within it writes
+// patterns to a scratch register that are read back at the safe rate.  SCI
+// reads are limited to CLKI/7, so each divider within that then reads the
+// patterns back itself.  Dividers over a limit aren't tried at all: the
+// chip may take a byte clocked too fast and fail later.
+void MidiSynth::calibrate() {
+	uint8_t i;
+	uint8_t safe = spiDividers[SPI_DIVIDERS - 1];
+	uint32_t clki = clkiHz();
+
+	for(i = 0; i < SPI_DIVIDERS - 1; i++) {
+		if(sckHz(spiDividers[i]) > clki / 4) continue;
+		if(scratchTest(spiDividers[i], safe)) break;
+	}
+	uint8_t write = spiDividers[i];
+	for(i = 0; i < SPI_DIVIDERS - 1; i++) {
+		if(sckHz(spiDividers[i]) > clki / 7) continue;
+		if(scratchTest(write, spiDividers[i])) break;
+	}
+	sciRate = spiDividers[i];
+	sdiRate = write;
+	MidiWriteRegister(SCI_AICTRL0, 0);
+}
+
+// Write patterns to SCI_AICTRL0 at one rate and read them back at another
+bool MidiSynth::scratchTest(uint8_t write, uint8_t read) {
+	static const uint16_t pattern[2] = {0xA55A, 0x5AA5};
+
+	for(uint8_t i = 0; i < 2; i++) {
+		sdiRate = write;
+		MidiWriteRegister(SCI_AICTRL0, pattern[i]);
+		sciRate = read;
+		if(MidiReadRegister(SCI_AICTRL0) != pattern[i]) return false;
+	}
+	return true;
+}
+
+// SPI clocks in Hz chosen by the calibration in poll()
+uint32_t MidiSynth::getSciClock() {
+	return sckHz(sciRate);
+}
+
+uint32_t MidiSynth::getSdiClock() {
+	return sckHz(sdiRate);
+}
+
+// Reread the shadowed registers from the chip, for when something other than
+// these functions may have changed them, such as a plugin or a soft reset
+void MidiSynth::resync() {
+	shadowValid = 0;
+	for(uint8_t i = 0; i < SCI_SHADOW_COUNT; i++) {
+		MidiReadRegister(shadowRegs[i]);
+	}
+}
+
 // Manipulate master volume
 void MidiSynth::setVolume(uint8_t leftchannel, uint8_t rightchannel){
 
-	VolL = leftchannel;
-	VolR = rightchannel;
 	MidiWriteRegister(SCI_VOL, leftchannel, rightchannel);
 }
 
 uint16_t MidiSynth::getVolume() {
-	uint16_t MP3SCI_VOL = MidiReadRegister(SCI_VOL);
+	uint16_t MP3SCI_VOL = shadowRead(SCI_VOL);
 	return MP3SCI_VOL;
 }
 
 // Manipulate EarSpeaker (synthetic spatial positioning)
 uint8_t MidiSynth::getEarSpeaker() {
 	uint8_t result = 0;
-	uint16_t MP3SCI_MODE = MidiReadRegister(SCI_MODE);
+	uint16_t MP3SCI_MODE = shadowRead(SCI_MODE);
 
 	// SM_EARSPEAKER bits are not adjacent hence need to add them together
 	if(MP3SCI_MODE & SM_EARSPEAKER_LO) {
@@ -141,7 +397,7 @@ uint8_t MidiSynth::getEarSpeaker() {
 }
 
 void MidiSynth::setEarSpeaker(uint16_t EarSpeaker) {
-	uint16_t MP3SCI_MODE = MidiReadRegister(SCI_MODE);
+	uint16_t MP3SCI_MODE = shadowRead(SCI_MODE);
 
 	// SM_EARSPEAKER bits are not adjacent hence need to add them individually
 	if(EarSpeaker & 0b01) {
@@ -158,52 +414,294 @@ void MidiSynth::setEarSpeaker(uint16_t EarSpeaker) {
 	MidiWriteRegister(SCI_MODE, MP3SCI_MODE);
 }
 
-// Toggle SPI control channel
-void MidiSynth::cs_low() {
+// Send real-time MIDI through the SDI data channel
+void MidiSynth::sendMidi(const uint8_t* buf, uint16_t len) {
+
+	// skip if the chip is in reset.
+	if(!digitalRead(resetPin)) return;
+
+	dcs_low(); // Select data
+	while(len) {
+		uint8_t n = len < SDI_MIDI_BATCH ? len : SDI_MIDI_BATCH;
+		len -= n;
+		// Wait for DREQ to go high indicating room for the next 32 bytes
+		while(!digitalRead(dreqPin)) ;
+		while(n--) {
+			SPI.transfer(0x00); // rtmidi expects each byte as 0x00, byte
+			SPI.transfer(*buf++);
+		}
+	}
+	dcs_high(); // Deselect data
+}
+
+// Send one MIDI channel message.  Program change (0xCn) and channel pressure
+// (0xDn) carry one data byte, the others two.
+void MidiSynth::sendMidi(uint8_t cmd, uint8_t data1, uint8_t data2) {
+	uint8_t msg[3] = {cmd, data1, data2};
+	uint8_t type = cmd & 0xF0;
+	sendMidi(msg, (type == 0xC0 || type == 0xD0) ? 2 : 3);
+}
+
+// Queue MIDI bytes without waiting on DREQ.  Returns false, and sends
+// nothing, if the message doesn't fit; try again later.
+bool MidiSynth::queueMidi(const uint8_t* buf, uint8_t len) {
+
+	if(len > queueFree()) {
+		queueStats.drops++;
+		return false;
+	}
+	// only this side moves the head
+	uint8_t head = queueHead;
+	while(len--) {
+		queue[head] = *buf++;
+		head = (head + 1) & (MIDI_QUEUE_SIZE - 1);
+	}
+	queueHead = head;
+	uint8_t depth = (head - queueTail) & (MIDI_QUEUE_SIZE - 1);
+	if(depth > queueStats.maxDepth) queueStats.maxDepth = depth;
+
+	// with DREQ already high no edge is coming, so start the drain here
+	flushMidi();
+	return true;
+}
+
+bool MidiSynth::queueMidi(uint8_t cmd, uint8_t data1, uint8_t data2) {
+	uint8_t msg[3] = {cmd, data1, data2};
+	uint8_t type = cmd & 0xF0;
+	return queueMidi(msg, (type == 0xC0 || type == 0xD0) ? 2 : 3);
+}
+
+// Room left in the queue, in bytes
+uint8_t MidiSynth::queueFree() {
+	return (queueTail - queueHead - 1) & (MIDI_QUEUE_SIZE - 1);
+}
+
+// Send what DREQ allows now, for callers that just released the SPI bus
+void MidiSynth::flushMidi() {
+	noInterrupts();
+	drainQueue();
+	interrupts();
+}
+
+void MidiSynth::getQueueStats(MidiQueueStats* stats) {
+	noInterrupts();
+	*stats = queueStats;
+	stats->depth = (queueHead - queueTail) & (MIDI_QUEUE_SIZE - 1);
+	interrupts();
+}
+
+void MidiSynth::clearQueueStats() {
+	noInterrupts();
+	queueStats.maxDepth = 0;
+	queueStats.drops = 0;
+	queueStats.maxStall = 0;
+	interrupts();
+}
+
+// Detach DREQ's interrupt if this chip attached it
+void MidiSynth::detachDreq() {
+	if(dreqInt >= 0 && dreqInt < MIDI_DREQ_INTS && dreqOwner[dreqInt] == this) {
+		detachInterrupt(dreqInt);
+		dreqOwner[dreqInt] = 0;
+	}
+}
+
+// DREQ interrupts, one per pin, each draining the chip that attached it
+void MidiSynth::dreqISR0() {
+	if(dreqOwner[0]) dreqOwner[0]->drainQueue();
+}
+
+void MidiSynth::dreqISR1() {
+	if(dreqOwner[1]) dreqOwner[1]->drainQueue();
+}
+
+// Nobody has the bus: no SD transfer, whose trailing byte is clocked after
+// its chip select goes high, and no chip select low, the VS1053s' or a
+// card's driven outside SDspi
+bool MidiSynth::busIdle() {
+	if(SDspi::busBusy() || !digitalRead(cardSelect)) return false;
+	for(MidiSynth* c = chips; c; c = c->next) {
+		if(!digitalRead(c->xcsPin) || !digitalRead(c->xdcsPin)) return false;
+	}
+	return true;
+}
+
+// Move queued bytes to SDI while DREQ is high, with interrupts off
+void MidiSynth::drainQueue() {
+
+	if(queueHead == queueTail) return;
+	// leave the bus alone if the chip is in reset or a transfer has it
+	if(!digitalRead(resetPin) || !busIdle()) return;
+
+	if(!digitalRead(dreqPin)) {
+		if(!stalled) {
+			stalled = true;
+			stallStart = micros();
+		}
+		return;
+	}
+	if(stalled) {
+		uint16_t stall = (uint16_t)micros() - stallStart;
+		if(stall > queueStats.maxStall) queueStats.maxStall = stall;
+		stalled = false;
+	}
+
+	// an interrupted transfer may have set its SPI clock but not yet
+	// pulled its chip select, so it gets its clock back
+	uint8_t spcr = SPCR;
+	uint8_t spsr = SPSR;
+	dcs_low(); // Select data
+	do {
+		// DREQ high guarantees room for one batch
+		uint8_t n = SDI_MIDI_BATCH;
+		while(n-- && queueTail != queueHead) {
+			SPI.transfer(0x00);
+			SPI.transfer(queue[queueTail]);
+			queueTail = (queueTail + 1) & (MIDI_QUEUE_SIZE - 1);
+		}
+	} while(queueTail != queueHead && digitalRead(dreqPin));
+	dcs_high(); // Deselect data
+	SPCR = spcr;
+	SPSR = spsr;
+
+	if(queueTail != queueHead) {
+		stalled = true;
+		stallStart = micros();
+	}
+}
+
+// Toggle SPI control channel, at sciRate for reads or sdiRate for writes
+void MidiSynth::cs_low(uint8_t rate) {
 	SPI.setDataMode(SPI_MODE0);
-	SPI.setClockDivider(spiRate); // Set SPI bus speed to 1MHz (16MHz / 16 = 1MHz)
-	digitalWrite(MIDI_XCS, LOW);
+	SPI.setClockDivider(rate);
+	digitalWrite(xcsPin, LOW);
 }
 
 void MidiSynth::cs_high() {
-	digitalWrite(MIDI_XCS, HIGH);
+	digitalWrite(xcsPin, HIGH);
 }
 
 // Toggle SPI data channel
 void MidiSynth::dcs_low() {
 	SPI.setDataMode(SPI_MODE0);
-	SPI.setClockDivider(spiRate); // Set SPI bus speed to 1MHz (16MHz / 16 = 1MHz)
-	digitalWrite(MIDI_XDCS, LOW);
+	SPI.setClockDivider(sdiRate);
+	digitalWrite(xdcsPin, LOW);
 }
 
 void MidiSynth::dcs_high() {
-	digitalWrite(MIDI_XDCS, HIGH);
+	digitalWrite(xdcsPin, HIGH);
+}
+
+// Shadow registers, kept in RAM so reads cost no bus traffic and writes of
+// the value already there can be skipped
+const uint8_t MidiSynth::shadowRegs[SCI_SHADOW_COUNT] = {
+	SCI_MODE, SCI_CLOCKF, SCI_VOL
+};
+
+// Index of a shadowed register, or -1
+int8_t MidiSynth::shadowSlot(uint8_t addressbyte) {
+	for(uint8_t i = 0; i < SCI_SHADOW_COUNT; i++) {
+		if(shadowRegs[i] == addressbyte) return i;
+	}
+	return -1;
+}
+
+// Note a value the chip now holds
+void MidiSynth::shadowStore(uint8_t addressbyte, uint16_t data) {
+	int8_t slot = shadowSlot(addressbyte);
+
+	if(slot < 0) return;
+	if(addressbyte == SCI_MODE && (data & SM_RESET)) {
+		// a soft reset puts every register back to its default
+		shadowValid = 0;
+		return;
+	}
+	shadow[slot] = data;
+	shadowValid |= 1 << slot;
+}
+
+// A register's value, from RAM once it has been read or written
+uint16_t MidiSynth::shadowRead(uint8_t addressbyte) {
+	int8_t slot = shadowSlot(addressbyte);
+
+	if(slot >= 0 && (shadowValid & 1 << slot)) return shadow[slot];
+	return MidiReadRegister(addressbyte);
 }
 
 // Directly manipulate VS1053 registers
 void MidiSynth::MidiWriteRegister(uint8_t addressbyte, uint16_t data) {
-	union twobyte val;
-	val.word = data;
-	MidiWriteRegister(addressbyte, val.byte[1], val.byte[0]);
+	SciWrite w = {addressbyte, data};
+	writeRegisters(&w, 1);
 }
 
 void MidiSynth::MidiWriteRegister(uint8_t addressbyte, uint8_t highbyte, uint8_t lowbyte) {
+	MidiWriteRegister(addressbyte, highbyte << 8 | lowbyte);
+}
+
+// Write a list of registers with one SPI setup.  Each word waits for DREQ
+// once, before it goes out: every SCI and SDI access waits the same way, so
+// nothing waits for the update to finish.  The datasheet ends each write
+// with XCS high, except a run to one register, sent as an SCI multiple
+// write.  Writes of a value the chip already holds are skipped.
+void MidiSynth::writeRegisters(const SciWrite* list, uint8_t n) {
+	int16_t open = -1; // register being written under XCS
+	bool ready = false;
+
+	for(; n; n--, list++) {
+		int8_t slot = shadowSlot(list->addr);
+		if(slot >= 0 && (shadowValid & 1 << slot) && shadow[slot] == list->data) {
+			continue;
+		}
+		if(!ready) {
+			// skip if the chip is in reset.
+			if(!digitalRead(resetPin)) return;
+			SPI.setDataMode(SPI_MODE0);
+			SPI.setClockDivider(sdiRate);
+			ready = true;
+		}
+		if(list->addr != open && open >= 0) cs_high();
+		// Wait for DREQ to go high indicating IC is available
+		while(!digitalRead(dreqPin)) ;
+		if(list->addr != open) {
+			digitalWrite(xcsPin, LOW);
+			SPI.transfer(0x02); // Write instruction
+			SPI.transfer(list->addr);
+			open = list->addr;
+		}
+		SPI.transfer(list->data >> 8);
+		SPI.transfer(list->data);
+		shadowStore(list->addr, list->data);
+	}
+	if(open >= 0) cs_high(); // Deselect Control
+}
+
+// SCI multiple write: n words to one register under a single XCS, taken
+// little-endian from data, or all equal to fill if data is 0.  Each word
+// still waits for DREQ, as an update can outlast a byte at fast SPI rates.
+void MidiSynth::MidiWriteRegisters(uint8_t addressbyte, const uint8_t* data,
+	uint16_t n, uint16_t fill) {
 
 	// skip if the chip is in reset.
-	if(!digitalRead(MIDI_RESET)) return;
+	if(!digitalRead(resetPin)) return;
 
 	// Wait for DREQ to go high indicating IC is available
-	while(!digitalRead(MIDI_DREQ)) ;
+	while(!digitalRead(dreqPin)) ;
 	// Select control
-	cs_low();
+	cs_low(sdiRate);
 
-	// SCI consists of instruction byte, address byte, and 16-bit data word.
 	SPI.transfer(0x02); // Write instruction
 	SPI.transfer(addressbyte);
-	SPI.transfer(highbyte);
-	SPI.transfer(lowbyte);
-	while(!digitalRead(MIDI_DREQ)) ; // Wait for DREQ to go high indicating command is complete
+	while(n--) {
+		if(data) {
+			fill = data[0] | data[1] << 8;
+			data += 2;
+		}
+		SPI.transfer(fill >> 8);
+		SPI.transfer(fill);
+		while(!digitalRead(dreqPin)) ; // Wait for the register update
+	}
 	cs_high(); // Deselect Control
+	shadowStore(addressbyte, fill); // the last word stays
 }
 
 uint16_t MidiSynth::MidiReadRegister (uint8_t addressbyte){
@@ -211,22 +709,23 @@ uint16_t MidiSynth::MidiReadRegister (uint8_t addressbyte){
 	union twobyte resultvalue;
 
 	// skip if the chip is in reset.
-	if(!digitalRead(MIDI_RESET)) return 0;
+	if(!digitalRead(resetPin)) return 0;
 
-	while(!digitalRead(MIDI_DREQ)) ; // Wait for DREQ to go high indicating IC is available
-	cs_low(); // Select control
+	while(!digitalRead(dreqPin)) ; // Wait for DREQ to go high indicating IC is available
+	cs_low(sciRate); // Select control
 
 	// SCI consists of instruction byte, address byte, and 16-bit data word.
 	SPI.transfer(0x03);  // Read instruction
 	SPI.transfer(addressbyte);
 
 	resultvalue.byte[1] = SPI.transfer(0xFF); // Read the first byte
-	while(!digitalRead(MIDI_DREQ)) ; // Wait for DREQ to go high indicating command is complete
+	while(!digitalRead(dreqPin)) ; // Wait for DREQ to go high indicating command is complete
 	resultvalue.byte[0] = SPI.transfer(0xFF); // Read the second byte
-	while(!digitalRead(MIDI_DREQ)) ; // Wait for DREQ to go high indicating command is complete
+	while(!digitalRead(dreqPin)) ; // Wait for DREQ to go high indicating command is complete
 
 	cs_high(); // Deselect Control
 
+	shadowStore(addressbyte, resultvalue.word);
 	return resultvalue.word;
 }
 
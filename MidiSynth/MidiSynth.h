@@ -22,39 +22,199 @@ extern SD sd;
 #define SCI_MODE              0x00
 #define SCI_CLOCKF            0x03
 #define SCI_VOL               0x0B
+#define SCI_WRAM              0x06
+#define SCI_AICTRL0           0x0C
+
+// Registers kept in RAM: SCI_MODE, SCI_CLOCKF and SCI_VOL
+#define SCI_SHADOW_COUNT      3
+
+// SDI takes each real-time MIDI byte padded to a word, and DREQ high
+// guarantees room for 32 bytes, so up to 16 MIDI bytes per DREQ check
+#define SDI_MIDI_BATCH        16
+
+// Plugin loader read size, a whole SD block where RAM allows
+#ifndef MIDI_LOAD_BUFFER
+#if defined(RAMEND) && RAMEND < 3000
+#define MIDI_LOAD_BUFFER      128
+#else
+#define MIDI_LOAD_BUFFER      512
+#endif
+#endif
+
+// Bytes in the queueMidi() ring buffer drained by the DREQ interrupt, a power
+// of two.  One byte is kept free to tell full from empty.
+#ifndef MIDI_QUEUE_SIZE
+#define MIDI_QUEUE_SIZE       32
+#endif
+
+// The VS1053's crystal in Hz, for the SPI clock limits.  SCI_CLOCKF's
+// SC_FREQ overrides it when set.
+#ifndef MIDI_XTALI
+#define MIDI_XTALI            12288000UL
+#endif
+
+// External interrupts a DREQ pin can be on, INT0 and INT1
+#define MIDI_DREQ_INTS        2
+#define MIDI_NO_INT           -1
+
+// poll() waits for DREQ instead of sleeping.  It rises about 22000 XTALI
+// cycles (1.8 ms) after reset and 1200 (0.1 ms) after an SCI_CLOCKF write;
+// these timeouts in ms leave room for a slow crystal start.  A card being
+// mounted alongside may still be in its ACMD41 loop, so the plugin load
+// waits for it as long as SDlite's init does.
+#define MIDI_BOOT_TIMEOUT     50
+#define MIDI_CLOCK_TIMEOUT    10
+#define MIDI_CARD_TIMEOUT     SD_INIT_TIMEOUT
+#define MIDI_START_TIMEOUT    100
+
+// poll() results, failures are the begin() error code negated
+#define MIDI_POLL_BUSY        0
+#define MIDI_POLL_DONE        1
+
+// poll() states
+#define MIDI_INIT_IDLE        0 // not started, or failed
+#define MIDI_INIT_BOOT        1 // waiting for DREQ after reset
+#define MIDI_INIT_CLOCK       2 // waiting for DREQ after the SCI_CLOCKF write
+#define MIDI_INIT_PLUGIN      3 // plugin to load, waits for the SD card
+#define MIDI_INIT_START       4 // waiting for DREQ as the plugin starts
+#define MIDI_INIT_DONE        5
+
+// Set nonzero to time the init stages, see MidiSynth::stageMicros()
+#ifndef USE_MIDI_PROFILE
+#define USE_MIDI_PROFILE      0
+#endif
+
+// init stages
+#define MIDI_STAGE_START      0 // start() entered
+#define MIDI_STAGE_BOOT       1 // out of reset, DREQ high, SCI_MODE checked
+#define MIDI_STAGE_CLOCK      2 // SCI_CLOCKF set, DREQ high, read back
+#define MIDI_STAGE_SETUP      3 // volume and EarSpeaker set
+#define MIDI_STAGE_PLUGIN     4 // plugin loaded
+#define MIDI_STAGE_READY      5 // plugin started, DREQ high
+#define MIDI_STAGE_COUNT      6
+
+#if USE_MIDI_PROFILE
+extern uint32_t midiStageStamp[MIDI_STAGE_COUNT];
+#define MIDI_PROFILE(stage) midiStageStamp[stage] = micros()
+#else
+#define MIDI_PROFILE(stage)
+#endif
 
 // Masks
+#define SM_RESET            0x0004
 #define SM_EARSPEAKER_LO    0x0010
 #define SM_EARSPEAKER_HI    0x0080
 #define SM_SDINEW           0x0800
 #define SM_LINE1            0x4000
 
+// Queued MIDI output statistics, see MidiSynth::getQueueStats()
+struct MidiQueueStats {
+	uint8_t depth;      // bytes waiting now
+	uint8_t maxDepth;   // most bytes ever waiting
+	uint16_t drops;     // messages refused because they didn't fit
+	uint16_t maxStall;  // longest wait in us for DREQ with bytes queued
+};
+
+// One register write for MidiSynth::writeRegisters()
+struct SciWrite {
+	uint8_t addr;
+	uint16_t data;
+};
+
 class MidiSynth {
 	public:
-		uint8_t begin();
+		// Pins default to MidiSynthPins.h.  Give each chip on the bus its own
+		// XCS, XDCS, DREQ and reset; dreqInt is DREQ's external interrupt, or
+		// MIDI_NO_INT to drain queued MIDI only from queueMidi() and flushMidi().
+		MidiSynth(uint8_t xcs = MIDI_XCS, uint8_t xdcs = MIDI_XDCS,
+			uint8_t dreq = MIDI_DREQ, uint8_t reset = MIDI_RESET,
+			int8_t dreqInt = MIDI_DREQINT);
+		~MidiSynth();
+		// The SD card's chip select, left alone by queued MIDI while low;
+		// SD_SEL by default
+		static void setCardSelect(uint8_t pin) { cardSelect = pin; }
+		uint8_t begin(const uint16_t* plugin = 0, uint16_t words = 0);
+		void start(const uint16_t* plugin = 0, uint16_t words = 0);
+		int8_t poll();
 		void end();
 		void setVolume(uint8_t, uint8_t);
 		uint16_t getVolume();
 		uint8_t getEarSpeaker();
 		void setEarSpeaker(uint16_t);
+		void resync();
+		uint32_t getSciClock();
+		uint32_t getSdiClock();
+		void writeRegisters(const SciWrite*, uint8_t);
+		void sendMidi(const uint8_t*, uint16_t);
+		void sendMidi(uint8_t, uint8_t, uint8_t);
+		bool queueMidi(const uint8_t*, uint8_t);
+		bool queueMidi(uint8_t, uint8_t, uint8_t);
+		uint8_t queueFree();
+		void flushMidi();
+		void getQueueStats(MidiQueueStats*);
+		void clearQueueStats();
+#if USE_MIDI_PROFILE
+		// microseconds the init spent reaching stage, see MIDI_STAGE_BOOT
+		static uint32_t stageMicros(uint8_t stage) {
+			return stage ? midiStageStamp[stage] - midiStageStamp[stage - 1] : 0;
+		}
+#endif
 
 	private:
-		uint8_t vs_init();
-		static void cs_low();
-		static void cs_high();
-		static void dcs_low();
-		static void dcs_high();
-		static void MidiWriteRegister(uint8_t, uint8_t, uint8_t);
-		static void MidiWriteRegister(uint8_t, uint16_t);
-		static uint16_t MidiReadRegister (uint8_t);
+		void cs_low(uint8_t);
+		void cs_high();
+		void dcs_low();
+		void dcs_high();
+		void MidiWriteRegister(uint8_t, uint8_t, uint8_t);
+		void MidiWriteRegister(uint8_t, uint16_t);
+		uint16_t MidiReadRegister (uint8_t);
+		static int8_t shadowSlot(uint8_t);
+		void shadowStore(uint8_t, uint16_t);
+		uint16_t shadowRead(uint8_t);
+		void MidiWriteRegisters(uint8_t, const uint8_t*, uint16_t, uint16_t);
 		uint8_t VSLoadUserCode(char*);
+		uint8_t VSLoadUserCode(const uint16_t*, uint16_t);
+		uint32_t clkiHz();
+		void calibrate();
+		bool scratchTest(uint8_t, uint8_t);
+		static bool busIdle();
+		void detachDreq();
+		static void dreqISR0();
+		static void dreqISR1();
+		void drainQueue();
 
-		// Rate of the SPI to be used with communicating to the VSdsp.
-		static uint16_t spiRate; 
-		// contains a local value of the VSdsp's master volume left channels
-		uint8_t VolL;
-		// contains a local value of the VSdsp's master volume Right channels
-		uint8_t VolR;
+		// pins, see the constructor
+		uint8_t xcsPin;
+		uint8_t xdcsPin;
+		uint8_t dreqPin;
+		uint8_t resetPin;
+		int8_t dreqInt;
+		// every chip constructed and the card, so a drain can leave a busy
+		// bus alone
+		static MidiSynth* chips;
+		static uint8_t cardSelect;
+		MidiSynth* next;
+		// chip whose DREQ each external interrupt drains
+		static MidiSynth* volatile dreqOwner[MIDI_DREQ_INTS];
+		// SPI dividers for SCI reads, and for SDI and SCI writes
+		uint8_t sciRate;
+		uint8_t sdiRate;
+		// MIDI output ring buffer, filled by queueMidi() and drained on DREQ
+		volatile uint8_t queue[MIDI_QUEUE_SIZE];
+		volatile uint8_t queueHead;
+		volatile uint8_t queueTail;
+		MidiQueueStats queueStats;
+		bool stalled;
+		uint16_t stallStart;
+		// init run by poll(): state, start of its DREQ wait in ms, plugin table
+		uint8_t initState;
+		uint16_t initT0;
+		const uint16_t* initPlugin;
+		uint16_t initWords;
+		// RAM copies of the registers in shadowRegs, a valid bit for each
+		static const uint8_t shadowRegs[SCI_SHADOW_COUNT];
+		uint16_t shadow[SCI_SHADOW_COUNT];
+		uint8_t shadowValid;
 };
 
 // Global structure to efficiently work with 16 bit words
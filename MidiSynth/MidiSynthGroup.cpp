@@ -0,0 +1,87 @@
+/* MidiSynthGroup.cpp
+ * James Lyden <james@lyden.org>
+ *
+ * Several VS1053s on one SPI bus played as one synth
+ */
+
+#include "MidiSynthGroup.h"
+
+MidiSynthGroup::MidiSynthGroup(MidiSynth* const* chips, uint8_t count)
+	: chips(chips), count(count > MIDI_GROUP_MAX ? MIDI_GROUP_MAX : count),
+	  nextVoice(0) {
+	for(uint8_t i = 0; i < 16; i++) chipOf[i] = this->count ? i % this->count : 0;
+}
+
+// Boot every chip, the resets and plugin loads interleaved as with
+// BootSequencer.  Returns 0, or the begin() error of the first chip to fail.
+uint8_t MidiSynthGroup::begin(const uint16_t* plugin, uint16_t words) {
+	uint8_t busy;
+
+	for(uint8_t i = 0; i < count; i++) chips[i]->start(plugin, words);
+	do {
+		busy = 0;
+		for(uint8_t i = 0; i < count; i++) {
+			int8_t result = chips[i]->poll();
+			if(result < 0) return -result;
+			if(result == MIDI_POLL_BUSY) busy++;
+		}
+	} while(busy);
+	return 0;
+}
+
+// Send a channel to one chip, or MIDI_SPREAD to share its voices
+void MidiSynthGroup::setChannel(uint8_t channel, uint8_t chip) {
+	if(chip != MIDI_SPREAD && chip >= count) return;
+	chipOf[channel & 0x0F] = chip;
+}
+
+uint8_t MidiSynthGroup::getChannel(uint8_t channel) {
+	return chipOf[channel & 0x0F];
+}
+
+void MidiSynthGroup::setVolume(uint8_t leftchannel, uint8_t rightchannel) {
+	for(uint8_t i = 0; i < count; i++) chips[i]->setVolume(leftchannel, rightchannel);
+}
+
+// Chip a message goes to, or MIDI_SPREAD for all of them.  System messages
+// go to all; on a spread channel only note-ons with a velocity are dealt.
+uint8_t MidiSynthGroup::route(uint8_t cmd, uint8_t data2) {
+	if(cmd >= 0xF0) return MIDI_SPREAD;
+	uint8_t chip = chipOf[cmd & 0x0F];
+	if(chip != MIDI_SPREAD || (cmd & 0xF0) != 0x90 || !data2) return chip;
+	chip = nextVoice;
+	if(++nextVoice == count) nextVoice = 0;
+	return chip;
+}
+
+void MidiSynthGroup::sendMidi(uint8_t cmd, uint8_t data1, uint8_t data2) {
+	uint8_t chip = route(cmd, data2);
+
+	if(chip != MIDI_SPREAD) {
+		chips[chip]->sendMidi(cmd, data1, data2);
+		return;
+	}
+	for(uint8_t i = 0; i < count; i++) chips[i]->sendMidi(cmd, data1, data2);
+}
+
+// Queue a message on its chip, or on all of them.  Returns false, and
+// queues nothing, if any of them has no room; try again later.
+bool MidiSynthGroup::queueMidi(uint8_t cmd, uint8_t data1, uint8_t data2) {
+	uint8_t type = cmd & 0xF0;
+	uint8_t len = (type == 0xC0 || type == 0xD0) ? 2 : 3;
+	uint8_t chip = route(cmd, data2);
+
+	if(chip != MIDI_SPREAD) return chips[chip]->queueMidi(cmd, data1, data2);
+	for(uint8_t i = 0; i < count; i++) {
+		// refused, and counted as a drop by the full chip
+		if(chips[i]->queueFree() < len) return chips[i]->queueMidi(cmd, data1, data2);
+	}
+	for(uint8_t i = 0; i < count; i++) chips[i]->queueMidi(cmd, data1, data2);
+	return true;
+}
+
+// Drain every chip's queue.  A DREQ edge that came while another chip had
+// the bus was skipped, so call this after long sends on any of them.
+void MidiSynthGroup::flushMidi() {
+	for(uint8_t i = 0; i < count; i++) chips[i]->flushMidi();
+}
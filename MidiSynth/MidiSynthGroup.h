@@ -0,0 +1,47 @@
+/* MidiSynthGroup.h
+ * James Lyden <james@lyden.org>
+ *
+ * Several VS1053s on one SPI bus played as one synth.  Each MIDI channel is
+ * mapped to one chip, or spread: its note-ons go to the chips in turn and
+ * everything else on it, note-offs included, to all of them, so a channel
+ * can play more voices than one DSP renders.  A note-off for a note a chip
+ * isn't playing is ignored, so nothing has to remember where notes went.
+ */
+
+#ifndef MidiSynthGroup_h
+#define MidiSynthGroup_h
+
+#include "MidiSynth.h"
+
+#ifndef MIDI_GROUP_MAX
+#define MIDI_GROUP_MAX        4
+#endif
+
+// setChannel() chip for a channel whose voices go to every chip in turn
+#define MIDI_SPREAD           0xFF
+
+class MidiSynthGroup {
+	public:
+		// count chips, constructed on their own pins.  Channel n starts
+		// on chip n % count.
+		MidiSynthGroup(MidiSynth* const* chips, uint8_t count);
+		uint8_t begin(const uint16_t* plugin = 0, uint16_t words = 0);
+		void setChannel(uint8_t channel, uint8_t chip);
+		uint8_t getChannel(uint8_t channel);
+		void setVolume(uint8_t, uint8_t);
+		void sendMidi(uint8_t, uint8_t, uint8_t);
+		bool queueMidi(uint8_t, uint8_t, uint8_t);
+		void flushMidi();
+
+	private:
+		uint8_t route(uint8_t, uint8_t);
+
+		MidiSynth* const* chips;
+		uint8_t count;
+		// chip index or MIDI_SPREAD for each channel
+		uint8_t chipOf[16];
+		// chip the next spread note-on goes to
+		uint8_t nextVoice;
+};
+
+#endif // MidiSynthGroup_h
@@ -8,7 +8,7 @@
 #ifndef MidiSynthPins_h
 #define MidiSynthPins_h
 
-// Pins
+// Pins, the MidiSynth constructor defaults; SD_SEL is the setCardSelect() default
 #define MIDI_XCS		6
 #define MIDI_XDCS		7
 #define MIDI_DREQ		2
@@ -4,30 +4,17 @@
 
 // MP3 library (and dependencies) used to patch in realtime MIDI capability
 #include <SPI.h>
-#include <SdFat.h>
-#include <SdFatUtil.h>
+#include <SDlite.h>
 #include <MidiSynth.h>
-// MIDI comms implemented as software serial port
-#include <SoftwareSerial.h>
+#include <BootSequencer.h>
 // I2C LCD/buttons combo
 #include <Wire.h>
-#include <Adafruit_MCP23017.h>
-#include <Adafruit_RGBLCDShield.h>
+#include <LCDlite.h>
 
 // Spawn global objects required by MP3 library and MIDI handlers
-SdFat sd;
+SD sd;
 MidiSynth midiSynth;
-SoftwareSerial midiPort(2,3); // RX pin, TX pin
-Adafruit_RGBLCDShield lcd = Adafruit_RGBLCDShield(); // SCL=A4, SDA=A5
-
-// constants defined for convenience
-#define RED 0x1
-#define YELLOW 0x3
-#define GREEN 0x2
-#define TEAL 0x6
-#define BLUE 0x4
-#define VIOLET 0x5
-#define WHITE 0x7
+LCDlite lcd; // SCL=A4, SDA=A5
 
 //----------------------------------------------------------------------------//
 // helper functions for MIDI protocol
@@ -36,13 +23,9 @@ Adafruit_RGBLCDShield lcd = Adafruit_RGBLCDShield(); // SCL=A4, SDA=A5
 // FIXME: enforce protocol restrictions
 void talkMIDI(byte cmd, byte data1, byte data2)
 {
-  midiPort.write(cmd);
-  midiPort.write(data1);
-
-  // Some commands only have one data byte. All cmds less than 0xBn have 2 data bytes
-  // (sort of: http://253.ccarh.org/handout/midiprotocol/)
-  if( (cmd & 0xF0) <= 0xB0)
-    midiPort.write(data2);
+  // Sent through the VS1053's SDI port, which takes a note-on in tens of
+  // microseconds instead of the ~1 ms three bytes need at 31250 baud
+  midiSynth.sendMidi(cmd, data1, data2);
 }
 
 // Send a MIDI note-on message. Channel ranges from 0-15
@@ -60,23 +43,60 @@ void noteOff(byte channel, byte note, byte release_velocity)
 //----------------------------------------------------------------------------//
 // Mandatory functions
 
+// Boot tasks, each polls one device's init
+int8_t lcdPoll() { return lcd.poll(); }
+int8_t sdPoll() { return sd.beginPoll(); }
+int8_t synthPoll() { return midiSynth.poll(); }
+
+// Bytes between the heap and the stack
+int freeRam()
+{
+	extern int __heap_start, *__brkval;
+	int v;
+	return (int) &v - (__brkval == 0 ? (int) &__heap_start : (int) __brkval);
+}
+
 void setup()
 {
 	int time = millis();		// track how long setup takes
+	BootSequencer boot;
 	
 	Serial.begin(115200);	// console I/O
-	midiPort.begin(31250);	// MIDI requires 31250 baud
-	lcd.begin(16, 2);			// initialize the 16x2 display
 
+	// Start the 16x2 display, the SD card (used to load patches to DSP) and
+	// the synthesizer together, so the LCD's power-on delay, the card's
+	// ACMD41 loop and the VS1053's boot overlap
+	lcd.start(16, 2);
+	sd.beginStart(SD_SEL, SPI_HALF_SPEED);
+	midiSynth.start();
+	boot.add(lcdPoll);
+	uint8_t sdTask = boot.add(sdPoll);
+	uint8_t synthTask = boot.add(synthPoll);
+	int8_t status = boot.run();
+
+	// the display is needed for errors
+	while(!lcd.poll()) ;
 	lcd.setBacklight(WHITE);
 	lcd.print(F("Initializing..."));
 
-	// Initialize the SD card, used to load patches to DSP
-	if(!sd.begin(SD_SEL, SPI_HALF_SPEED)) sd.initErrorHalt();
-	if(!sd.chdir("/")) sd.errorHalt("sd.chdir");
+	// the synthesizer gives up waiting for a card that is slow to mount,
+	// so finish mounting it before retrying
+	int8_t sdStatus = boot.result(sdTask);
+	while(!sdStatus) sdStatus = sdPoll();
+	if(sdStatus < 0) {
+		lcd.setBacklight(RED);
+		lcd.setCursor(0, 1);
+		lcd.print(F("SD error 0x")); lcd.print(sd.card()->errorCode(), HEX);
+		while(1) ;
+	}
 
-	// Initialize the synthesizer
-	int result = midiSynth.begin();
+	// Retry the synthesizer
+	int result = status == -1 - synthTask ? -boot.result(synthTask) : 0;
+	if(result != 0) {
+		// at once: it may only have been waiting for the card
+		midiSynth.end();
+		result = midiSynth.begin();
+	}
 	while(result != 0) {
 		lcd.setBacklight(RED);
 		lcd.setCursor(0, 1);
@@ -94,7 +114,7 @@ void setup()
 	lcd.clear();
 	lcd.print(F("Took ")); lcd.print(time); lcd.print(F(" ms"));
 	lcd.setCursor(0, 1);
-	lcd.print(F("Free RAM = ")); lcd.print(FreeRam(), DEC);
+	lcd.print(F("Free RAM = ")); lcd.print(freeRam(), DEC);
 	delay(5000);
 
 
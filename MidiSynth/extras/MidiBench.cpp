@@ -0,0 +1,485 @@
+/* Host MIDI benchmark for MidiSynth
+ * James Lyden <james@lyden.org>
+ *
+ * Boots MidiSynth against VSemu, loading the plugin from a flash table and
+ * through SDlite from an SDemu card on the same bus, then compares real-time MIDI sent through
+ * sendMidi() on SDI with the 31250 baud serial path SynthTest used.  The
+ * SynthTest setup, LCD on the host Wire shim then SD then synth, is timed
+ * one after another and interleaved by BootSequencer.  A second VSemu on
+ * its own pins checks that MidiSynthGroup routes each channel's traffic to
+ * its chip and spreads voices over both.  Times are virtual,
+ * bus and emulated chip only, so results repeat exactly.
+ *
+ * If rtmidi.053 on the image is not a plugin, a synthetic one of the same
+ * size is written over its blocks in the RAM copy so the load still runs.
+ *
+ * Add -DUSE_MIDI_PROFILE=1 for init stage times.
+ *
+ * Build from the MidiSynth directory:
+ *   g++ -O2 -DARDUINO=105 -Iextras/host -I../SDlite/extras/host -I. \
+ *     -I../SDlite -I../SDlite/extras -I../LCDlite -o MidiBench \
+ *     extras/MidiBench.cpp MidiSynth.cpp MidiSynthGroup.cpp \
+ *     ../SDlite/SDlite.cpp \
+ *     ../SDlite/SDlite-SPI.cpp ../SDlite/SDlite-vol.cpp \
+ *     ../SDlite/SDlite-file.cpp ../LCDlite/LCDlite.cpp \
+ *     ../LCDlite/MCP23017.cpp extras/host/Wire.cpp \
+ *     ../SDlite/extras/host/Arduino.cpp
+ *
+ * Usage: MidiBench card.img
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <MidiSynth.h>
+#include <MidiSynthGroup.h>
+#include <BootSequencer.h>
+#include <LCDlite.h>
+#include <Wire.h>
+#include <SDemu.h>
+#include <SDimage.h>
+#include "VSemu.h"
+
+// a second chip on analog pins, its DREQ on INT1
+#define XCS2 14
+#define XDCS2 15
+#define DREQ2 3
+#define RESET2 16
+
+SD sd;
+MidiSynth midiSynth;
+MidiSynth midiSynth2(XCS2, XDCS2, DREQ2, RESET2, 1);
+LCDlite lcd;
+static VSemu vs;
+static VSemu vs2(XCS2, XDCS2, DREQ2, RESET2);
+
+#define PLUGIN "rtmidi.053"
+#define NOTES 1000
+#define LOOP_US 100
+
+// expected WRAM after the plugin load
+static uint16_t expect[0x10000];
+static uint8_t plugin[0x10000];
+
+// plugin words as a flash table
+static uint16_t table[0x8000];
+
+// virtual microseconds since t0
+static double since(uint64_t t0) { return (hostNanos() - t0) / 1000.0; }
+
+// WRAM words of a chip that differ from expect[]
+static uint32_t wramErrors(VSemu& chip) {
+	uint32_t bad = 0;
+	for(uint32_t a = 0; a < 0x10000; a++) bad += chip.mem(a) != expect[a];
+	return bad;
+}
+
+// Report a boot, return false if it failed
+static bool boot(const char* label, int result, double us, uint32_t cardBytes) {
+	uint32_t bad;
+
+	if(result) {
+		printf("%s failed %d\n", label, result);
+		return false;
+	}
+	bad = wramErrors(vs);
+	printf("%-20s %7.1f ms  plugin load %6.1f ms  %u SCI writes, "
+		"%u card bytes, WRAM %s\n", label, us / 1000, vs.loadNanos / 1e6,
+		vs.sciWrites, cardBytes, bad ? "WRONG" : "ok");
+#if USE_MIDI_PROFILE
+	static const char* stage[] = {"", "boot", "clock", "setup", "plugin", "ready"};
+	printf("%-20s", "");
+	for(uint8_t i = 1; i < MIDI_STAGE_COUNT; i++) {
+		printf(" %s %.2f", stage[i], midiSynth.stageMicros(i) / 1000.0);
+	}
+	printf(" ms\n");
+#endif
+	return true;
+}
+
+//----------------------------------------------------------------------------//
+// Plugin image helpers
+
+// Decode a plugin into expect[], return the WRAM words or 0 if it isn't one
+static uint32_t pluginWords(const uint8_t* p, uint32_t size) {
+	uint32_t words = 0;
+	uint32_t i = 0;
+	uint16_t wramAddr = 0;
+
+	memset(expect, 0, sizeof(expect));
+	while(i + 4 <= size) {
+		uint16_t addr = p[i] | p[i + 1] << 8;
+		uint16_t n = p[i + 2] | p[i + 3] << 8;
+		bool rle = n & 0x8000;
+		i += 4;
+		n &= 0x7FFF;
+		if(addr > 0x0F || n == 0 || i + 2 * (rle ? 1 : n) > size) return 0;
+		for(uint16_t k = 0; k < n; k++) {
+			uint16_t val = p[i] | p[i + 1] << 8;
+			if(!rle) i += 2;
+			if(addr == 0x07) wramAddr = val;
+			if(addr == 0x06) {
+				expect[wramAddr++] = val;
+				words++;
+			}
+		}
+		if(rle) i += 2;
+	}
+	return i == size ? words : 0;
+}
+
+static uint8_t* put(uint8_t* p, uint16_t w) {
+	*p++ = w;
+	*p++ = w >> 8;
+	return p;
+}
+
+// Synthetic plugin of size bytes: address and copy records with a few runs,
+// ending with the start address in SCI_AIADDR
+static void pluginMake(uint8_t* p, uint32_t size) {
+	int32_t left = size / 2 - 3;
+	uint16_t addr = 0x0800;
+
+	srand(53);
+	while(left > 0) {
+		p = put(put(put(p, 0x07), 1), addr);
+		left -= 3;
+		if(left >= 12 && rand() % 8 == 0) {
+			uint16_t n = 8 + rand() % 32;
+			p = put(put(put(p, 0x06), 0x8000 | n), 0);
+			left -= 3;
+			addr += n;
+			continue;
+		}
+		int32_t n = 16 + rand() % 112;
+		if(left - 2 - n < 6) n = left - 2;
+		p = put(put(p, 0x06), n);
+		for(int32_t k = 0; k < n; k++) p = put(p, rand());
+		left -= 2 + n;
+		addr += n;
+	}
+	put(put(put(p, 0x0A), 1), 0x50);
+}
+
+//----------------------------------------------------------------------------//
+// Boot tasks as in SynthTest
+static int8_t lcdPoll() { return lcd.poll(); }
+static int8_t sdPoll() { return sd.beginPoll(); }
+static int8_t synthPoll() { return midiSynth.poll(); }
+
+//----------------------------------------------------------------------------//
+// Serial path: SoftwareSerial writes one byte in ten bit times at 31250 baud
+static void serialWrite(uint8_t b) {
+	hostAdvance(320000);
+	vs.uartByte(b);
+}
+
+static void serialMidi(uint8_t cmd, uint8_t data1, uint8_t data2) {
+	serialWrite(cmd);
+	serialWrite(data1);
+	serialWrite(data2);
+}
+
+//----------------------------------------------------------------------------//
+int main(int argc, char* argv[]) {
+	SDimage image;
+	SDfile file;
+	SDextent ext[16];
+	uint8_t msg[3 * NOTES];
+	uint32_t size;
+	uint32_t words;
+	uint64_t t0;
+	double us;
+	int n;
+
+	if(argc < 2 || !image.begin(argv[1])) {
+		fprintf(stderr, "usage: MidiBench card.img\n");
+		return 1;
+	}
+	uint8_t* ram = reinterpret_cast<uint8_t*>(malloc(512UL * image.blockCount()));
+	if(!ram) return 1;
+	memcpy(ram, image.data(), 512UL * image.blockCount());
+	SDemu card(ram, image.blockCount(), SD_CARD_TYPE_SDHC, SD_SEL);
+	HostSpiBus bus;
+	bus.add(&card);
+	bus.add(&vs);
+	bus.add(&vs2);
+	hostSpiAttach(&bus);
+	hostVirtualTime(true);
+
+	if(!sd.begin(SD_SEL, SPI_HALF_SPEED)) {
+		printf("sd.begin failed %X\n", sd.card()->errorCode());
+		return 1;
+	}
+	if(!file.open(PLUGIN, O_READ)) {
+		printf("open %s failed\n", PLUGIN);
+		return 1;
+	}
+	size = file.read(plugin, sizeof(plugin));
+	if(!(words = pluginWords(plugin, size))) {
+		// write a synthetic plugin behind the volume's back
+		pluginMake(plugin, size);
+		words = pluginWords(plugin, size);
+		n = file.extents(ext, 16);
+		for(uint32_t off = 0, i = 0; (int)i < n; i++) {
+			for(uint32_t b = 0; b < ext[i].count && off < size; b++, off += 512) {
+				memcpy(ram + 512 * (ext[i].block + b), plugin + off,
+					size - off < 512 ? size - off : 512);
+			}
+		}
+		printf("synthetic ");
+	}
+	file.close();
+	// remount so no cached block predates the patch
+	card.powerUp();
+	if(!sd.begin(SD_SEL, SPI_HALF_SPEED)) return 1;
+	printf("plugin %u bytes, %u words\n", size, words);
+
+	// boot from the table plugin2h would make, then from a power cycled
+	// card, which has to be mounted first
+	for(uint32_t i = 0; i < size / 2; i++) {
+		table[i] = plugin[2 * i] | plugin[2 * i + 1] << 8;
+	}
+	vs.clear();
+	t0 = hostNanos();
+	n = midiSynth.begin(table, size / 2);
+	if(!boot("begin(table)", n, since(t0), 0)) return 1;
+	printf("%-20s SCI %lu kHz, SDI %lu kHz after calibration, %u clock errors\n",
+		"", (unsigned long)midiSynth.getSciClock() / 1000,
+		(unsigned long)midiSynth.getSdiClock() / 1000, vs.clockErrors);
+	card.powerUp();
+	card.clear();
+	vs.clear();
+	vs.clearMem();
+	t0 = hostNanos();
+	if(!sd.begin(SD_SEL, SPI_HALF_SPEED)) return 1;
+	us = since(t0);
+	n = midiSynth.begin();
+	if(!boot("sd.begin, begin()", n, since(t0), card.bytes)) return 1;
+	printf("%-20s %7.1f ms of that in sd.begin(), table costs %u bytes of flash\n",
+		"", us / 1000, size);
+
+	// SynthTest's setup: the LCD, the card and the synth one after another,
+	// then all three started together and polled by BootSequencer
+	card.powerUp();
+	card.clear();
+	vs.clear();
+	vs.clearMem();
+	t0 = hostNanos();
+	lcd.begin(16, 2);
+	double lcdUs = since(t0);
+	if(!sd.begin(SD_SEL, SPI_HALF_SPEED)) return 1;
+	double sdUs = since(t0) - lcdUs;
+	n = midiSynth.begin();
+	us = since(t0);
+	printf("\n%-20s %7.1f ms  lcd %.1f, sd %.1f, synth %.1f ms, %u I2C bytes\n",
+		"one after another", us / 1000, lcdUs / 1000, sdUs / 1000,
+		(us - lcdUs - sdUs) / 1000, Wire.bytes);
+	if(n) return 1;
+
+	BootSequencer seq;
+	card.powerUp();
+	card.clear();
+	vs.clear();
+	vs.clearMem();
+	Wire.bytes = 0;
+	t0 = hostNanos();
+	uint32_t m0 = micros();
+	lcd.start(16, 2);
+	sd.beginStart(SD_SEL, SPI_HALF_SPEED);
+	midiSynth.start();
+	seq.add(lcdPoll);
+	seq.add(sdPoll);
+	seq.add(synthPoll);
+	n = seq.run();
+	us = since(t0);
+	printf("%-20s %7.1f ms  lcd %.1f, sd %.1f, synth %.1f ms done, %u I2C bytes\n",
+		"BootSequencer", us / 1000, (seq.doneAt(0) - m0) / 1000.0,
+		(seq.doneAt(1) - m0) / 1000.0, (seq.doneAt(2) - m0) / 1000.0, Wire.bytes);
+	if(!boot("interleaved", n == 1 ? 0 : n, us, card.bytes)) return 1;
+
+	// one note-on from the call to the DSP parsing its last byte
+	printf("\n%-24s %12s %12s\n", "", "serial", "SDI");
+	t0 = hostNanos();
+	serialMidi(0x90, 60, 100);
+	double serialNote = (vs.noteOnNanos - t0) / 1000.0;
+	t0 = hostNanos();
+	midiSynth.sendMidi(0x90, 60, 100);
+	printf("%-24s %9.1f us %9.1f us\n", "note-on latency", serialNote,
+		(vs.noteOnNanos - t0) / 1000.0);
+
+	// note-on and note-off pairs, one call per message
+	vs.clear();
+	t0 = hostNanos();
+	for(uint16_t i = 0; i < NOTES; i++) serialMidi(i & 1 ? 0x80 : 0x90, 60, 100);
+	double serialRate = 1e9 * vs.midiBytes / (vs.midiNanos - t0);
+	vs.clear();
+	t0 = hostNanos();
+	for(uint16_t i = 0; i < NOTES; i++) {
+		midiSynth.sendMidi(i & 1 ? 0x80 : 0x90, 60, 100);
+	}
+	printf("%-24s %9.0f B/s %8.0f B/s\n", "3-byte messages", serialRate,
+		1e9 * vs.midiBytes / (vs.midiNanos - t0));
+
+	// the same stream in one call
+	for(uint16_t i = 0; i < NOTES; i++) {
+		msg[3 * i] = i & 1 ? 0x80 : 0x90;
+		msg[3 * i + 1] = 60;
+		msg[3 * i + 2] = 100;
+	}
+	vs.clear();
+	t0 = hostNanos();
+	midiSynth.sendMidi(msg, sizeof(msg));
+	printf("%-24s %9.0f B/s %8.0f B/s\n", "one buffer", serialRate,
+		1e9 * vs.midiBytes / (vs.midiNanos - t0));
+
+	// a loaded DSP parsing slower than the loop sends: once the FIFO fills
+	// sendMidi() waits for DREQ, queueMidi() refuses and the loop retries
+	VSemuTiming loaded = VSEMU_TYPICAL;
+	loaded.midiCycles = 4000;
+	vs.setTiming(loaded);
+	printf("\nloaded DSP, one message per %u us loop\n", LOOP_US);
+	uint64_t inCalls = 0;
+	vs.clear();
+	t0 = hostNanos();
+	for(uint16_t i = 0; i < NOTES; i++) {
+		uint64_t t = hostNanos();
+		midiSynth.sendMidi(i & 1 ? 0x80 : 0x90, 60, 100);
+		inCalls += hostNanos() - t;
+		delayMicroseconds(LOOP_US);
+	}
+	printf("%-24s %9.1f us per message in sendMidi, done %.1f ms\n", "sendMidi",
+		inCalls / 1000.0 / NOTES, (vs.midiNanos - t0) / 1e6);
+	while(hostNanos() < vs.midiNanos) delay(1);
+
+	MidiQueueStats stats;
+	midiSynth.clearQueueStats();
+	inCalls = 0;
+	vs.clear();
+	t0 = hostNanos();
+	for(uint16_t i = 0; i < NOTES;) {
+		uint64_t t = hostNanos();
+		if(midiSynth.queueMidi(i & 1 ? 0x80 : 0x90, 60, 100)) i++;
+		inCalls += hostNanos() - t;
+		delayMicroseconds(LOOP_US);
+	}
+	while(midiSynth.queueFree() < MIDI_QUEUE_SIZE - 1) delay(1);
+	midiSynth.getQueueStats(&stats);
+	printf("%-24s %9.1f us per message in queueMidi, done %.1f ms\n",
+		"queueMidi", inCalls / 1000.0 / NOTES, (vs.midiNanos - t0) / 1e6);
+	printf("%-24s max depth %u, refused %u, max stall %u us\n", "",
+		stats.maxDepth, stats.drops, stats.maxStall);
+	vs.setTiming(VSEMU_TYPICAL);
+
+	// volume and EarSpeaker changes, one call each or one batch
+	vs.clear();
+	t0 = hostNanos();
+	for(uint16_t i = 0; i < NOTES; i++) {
+		midiSynth.setVolume(i & 1 ? 25 : 26, 25);
+		midiSynth.setEarSpeaker(i & 1 ? 3 : 2);
+	}
+	us = since(t0) / NOTES;
+	vs.clear();
+	t0 = hostNanos();
+	for(uint16_t i = 0; i < NOTES; i++) {
+		SciWrite setup[2] = {
+			{SCI_VOL, (uint16_t)((i & 1 ? 25 : 26) << 8 | 25)},
+			{SCI_MODE, (uint16_t)(SM_LINE1 | SM_SDINEW | SM_EARSPEAKER_HI
+				| (i & 1 ? SM_EARSPEAKER_LO : 0))}
+		};
+		midiSynth.writeRegisters(setup, 2);
+	}
+	printf("\n%-24s %9.1f us one call each, %.1f us in writeRegisters()\n",
+		"volume + EarSpeaker", us, since(t0) / NOTES);
+
+	// UI code polling the synth's state and setting what it already holds
+	vs.clear();
+	t0 = hostNanos();
+	for(uint16_t i = 0; i < NOTES; i++) {
+		midiSynth.getVolume();
+		midiSynth.getEarSpeaker();
+		midiSynth.setVolume(25, 25);
+	}
+	printf("%-24s %9.1f us per poll, %u SCI reads, %u SCI writes\n", "UI poll",
+		since(t0) / NOTES, vs.sciReads, vs.sciWrites);
+	vs.clear();
+	t0 = hostNanos();
+	midiSynth.resync();
+	printf("%-24s %9.1f us, %u SCI reads\n", "resync()", since(t0), vs.sciReads);
+
+	// a second chip on its own pins and a group dealing channels and
+	// voices between the two; each chip must see only its own traffic
+	MidiSynth* pair[2] = {&midiSynth, &midiSynth2};
+	MidiSynthGroup group(pair, 2);
+	vs.clear();
+	vs.clearMem();
+	vs2.clear();
+	vs2.clearMem();
+	t0 = hostNanos();
+	n = group.begin(table, size / 2);
+	if(n) {
+		printf("group.begin() failed %d\n", n);
+		return 1;
+	}
+	printf("\n%-24s %9.1f ms both booted, WRAM %s, %s\n", "group.begin(table)",
+		since(t0) / 1000, wramErrors(vs) ? "WRONG" : "ok",
+		wramErrors(vs2) ? "WRONG" : "ok");
+
+	// channels 0 to 3 on their chips, channel 9 spread over both
+	group.setChannel(9, MIDI_SPREAD);
+	vs.clear();
+	vs2.clear();
+	for(uint16_t i = 0; i < NOTES; i++) {
+		uint8_t ch = i % 5 == 4 ? 9 : i % 5;
+		group.sendMidi(0x90 | ch, 60, 100);
+		group.sendMidi(0x80 | ch, 60, 100);
+	}
+	uint32_t wrong = 0;
+	for(uint8_t ch = 0; ch < 4; ch++) {
+		VSemu& own = ch & 1 ? vs2 : vs;
+		VSemu& other = ch & 1 ? vs : vs2;
+		wrong += own.channelNotes[ch] != NOTES / 5 || other.channelNotes[ch];
+	}
+	wrong += vs.channelNotes[9] != NOTES / 10 || vs2.channelNotes[9] != NOTES / 10;
+	printf("%-24s chip 1 %u note-ons, chip 2 %u, spread %u + %u, routing %s\n",
+		"sendMidi()", vs.noteOns, vs2.noteOns, vs.channelNotes[9],
+		vs2.channelNotes[9], wrong ? "WRONG" : "ok");
+
+	// the loaded DSP again, one chip against a spread channel on two, both
+	// drained by their own DREQ interrupt
+	vs.setTiming(loaded);
+	vs2.setTiming(loaded);
+	vs.clear();
+	t0 = hostNanos();
+	for(uint16_t i = 0; i < NOTES;) {
+		if(midiSynth.queueMidi(i & 1 ? 0x80 : 0x90, 60, 100)) i++;
+		delayMicroseconds(LOOP_US);
+	}
+	while(midiSynth.queueFree() < MIDI_QUEUE_SIZE - 1) delay(1);
+	double single = (vs.midiNanos - t0) / 1e6;
+	while(hostNanos() < vs.midiNanos) delay(1);
+	group.setChannel(0, MIDI_SPREAD);
+	vs.clear();
+	vs2.clear();
+	t0 = hostNanos();
+	for(uint16_t i = 0; i < NOTES;) {
+		if(group.queueMidi(i & 1 ? 0x80 : 0x90, 60, 100)) i++;
+		delayMicroseconds(LOOP_US);
+	}
+	while(midiSynth.queueFree() < MIDI_QUEUE_SIZE - 1
+		|| midiSynth2.queueFree() < MIDI_QUEUE_SIZE - 1) delay(1);
+	uint64_t last = vs.midiNanos > vs2.midiNanos ? vs.midiNanos : vs2.midiNanos;
+	printf("%-24s %9.1f ms on one chip, %.1f ms spread over two, %u + %u note-ons\n",
+		"loaded queueMidi()", single, (last - t0) / 1e6, vs.noteOns, vs2.noteOns);
+	if(vs.noteOns + vs2.noteOns != NOTES / 2) wrong++;
+	vs.setTiming(VSEMU_TYPICAL);
+	vs2.setTiming(VSEMU_TYPICAL);
+
+	printf("\npad errors %u, overruns %u, clock errors %u\n",
+		vs.padErrors + vs2.padErrors, vs.overruns + vs2.overruns,
+		vs.clockErrors + vs2.clockErrors);
+	if(wrong) return 1;
+
+	hostSpiAttach(0);
+	free(ram);
+	return 0;
+}
@@ -0,0 +1,324 @@
+/* Host VS1053 emulator for MidiSynth
+ * James Lyden <james@lyden.org>
+ *
+ * Answers SCI register reads and writes and takes SDI data so MidiSynth runs
+ * unchanged on a Linux host.  It goes on the SDlite host shim's SPI bus,
+ * next to an SDemu card when the plugin is loaded from SD, with
+ * hostVirtualTime() on.  DREQ follows the datasheet: low for the boot after
+ * reset, for the update after each SCI write, and while the SDI FIFO has
+ * fewer than 32 bytes free.  Once a plugin is started through SCI_AIADDR the
+ * SDI data is taken as real-time MIDI, 0x00 then the MIDI byte, and parsed
+ * on the emulated DSP clock.  Bytes clocked faster than the datasheet allows
+ * for the current CLKI are garbled, so SPI rate calibration can be tried.
+ */
+
+#ifndef VSemu_h
+#define VSemu_h
+#include <Arduino.h>
+#include "MidiSynthPins.h"
+
+// Registers the emulator treats specially
+#define VSEMU_SCI_STATUS      0x01
+#define VSEMU_SCI_CLOCKF      0x03
+#define VSEMU_SCI_WRAM        0x06
+#define VSEMU_SCI_WRAMADDR    0x07
+#define VSEMU_SCI_AIADDR      0x0A
+#define VSEMU_SM_RESET        0x0004
+
+// DSP timing model
+struct VSemuTiming {
+	uint32_t bootNanos;     // DREQ low after reset, 22000 XTALI cycles
+	uint16_t sciCycles;     // DREQ low after an SCI write, CLKI cycles
+	uint16_t clockfCycles;  // DREQ low after an SCI_CLOCKF write, XTALI cycles
+	uint16_t midiCycles;    // real-time MIDI parse of one byte, CLKI cycles
+};
+// Datasheet figures, the MIDI parse cost is a guess
+VSemuTiming const VSEMU_TYPICAL = {1800000, 80, 1200, 100};
+
+class VSemu : public HostSpiDev {
+	public:
+		VSemu(uint8_t xcs = MIDI_XCS, uint8_t xdcs = MIDI_XDCS,
+			uint8_t dreq = MIDI_DREQ, uint8_t reset = MIDI_RESET)
+			: xcsPin(xcs), xdcsPin(xdcs), dreqPin(dreq), resetPin(reset),
+			  xcs(false), xdcs(false), resetLevel(LOW), timing(VSEMU_TYPICAL) {
+			clearMem();
+			hardReset();
+			clear();
+		}
+
+		// Zero the counters
+		void clear() {
+			sciWrites = sciReads = wramWords = sdiBytes = 0;
+			midiBytes = noteOns = padErrors = overruns = clockErrors = 0;
+			memset(channelNotes, 0, sizeof(channelNotes));
+		}
+
+		void setTiming(const VSemuTiming& t) { timing = t; }
+
+		// Zero the DSP memory so a load can be checked again
+		void clearMem() { memset(wram, 0, sizeof(wram)); }
+
+		// A MIDI byte arriving on the UART RX pin, 31250 baud framing is
+		// the sender's business
+		void uartByte(uint8_t b) { midiByte(b, hostNanos()); }
+
+		// Peek at the chip
+		uint16_t reg(uint8_t addr) { return sci[addr & 0x0F]; }
+		uint16_t mem(uint16_t addr) { return wram[addr]; }
+		bool running() { return started; }
+		bool ready() { return hostNanos() >= busyUntil && fifoFree() >= 32; }
+
+		// Host shim hooks
+		void pinWrite(uint8_t pin, uint8_t val) {
+			if(pin == xcsPin) {
+				xcs = val == LOW;
+				sciPos = 0;
+			} else if(pin == xdcsPin) {
+				xdcs = val == LOW;
+			} else if(pin == resetPin) {
+				if(resetLevel == LOW && val == HIGH) {
+					hardReset();
+					busyUntil = hostNanos() + timing.bootNanos;
+				}
+				resetLevel = val;
+			}
+		}
+
+		int pinRead(uint8_t pin) {
+			if(pin == dreqPin) return resetLevel == HIGH && ready() ? HIGH : LOW;
+			return -1;
+		}
+
+		uint8_t transfer(uint8_t in) {
+			uint64_t now = hostNanos();
+
+			if(resetLevel == LOW) return 0xFF;
+			if(xcs) return sciByte(in, now);
+			if(xdcs) sdiByte(in, now);
+			return 0xFF;
+		}
+
+		// Counters
+		uint32_t sciWrites;     // SCI words written
+		uint32_t sciReads;      // SCI words read
+		uint32_t wramWords;     // words written through SCI_WRAM
+		uint32_t sdiBytes;      // bytes clocked in on SDI
+		uint32_t midiBytes;     // MIDI bytes parsed
+		uint32_t noteOns;       // note-on messages parsed
+		uint32_t channelNotes[16]; // the same for each MIDI channel
+		uint32_t padErrors;     // SDI MIDI words whose first byte was not 0x00
+		uint32_t overruns;      // bytes sent with DREQ low and no room
+		uint32_t clockErrors;   // bytes clocked faster than the chip allows
+		uint64_t midiNanos;     // when the last MIDI byte was parsed
+		uint64_t noteOnNanos;   // when the last note-on was parsed
+		uint64_t loadNanos;     // first WRAM write to the SCI_AIADDR start
+
+	private:
+		static uint16_t const FIFO_SIZE = 2048;
+		static uint32_t const XTALI = 12288000;
+
+		uint8_t xcsPin;
+		uint8_t xdcsPin;
+		uint8_t dreqPin;
+		uint8_t resetPin;
+		bool xcs;
+		bool xdcs;
+		uint8_t resetLevel;
+		VSemuTiming timing;
+
+		uint16_t sci[16];
+		uint16_t wram[0x10000];
+		bool started;
+		uint64_t loadStart;
+		uint64_t busyUntil;
+		// SCI transaction: byte position, instruction, register, data
+		uint8_t sciPos;
+		uint8_t sciOp;
+		uint8_t sciAddr;
+		uint16_t sciData;
+		// SDI FIFO as the parse times of the words still queued
+		uint64_t fifo[FIFO_SIZE / 2];
+		uint16_t fifoHead;
+		uint16_t fifoCount;
+		uint64_t parseAt;
+		bool sdiOdd;
+		uint8_t sdiPad;
+		// running status MIDI parser
+		uint8_t midiStatus;
+		uint8_t midiData;
+
+		void hardReset() {
+			memset(sci, 0, sizeof(sci));
+			sci[0] = 0x4800; // SM_LINE1 | SM_SDINEW
+			sci[VSEMU_SCI_STATUS] = 0x0040; // SS_VER 4, VS1053
+			started = false;
+			loadStart = loadNanos = 0;
+			busyUntil = 0;
+			fifoHead = fifoCount = 0;
+			parseAt = 0;
+			sdiOdd = false;
+			midiStatus = midiData = 0;
+		}
+
+		// CLKI from the SC_MULT field of SCI_CLOCKF, 1.0x to 5.0x XTALI
+		uint32_t clki() {
+			static const uint8_t mult[8] = {2, 4, 5, 6, 7, 8, 9, 10};
+			return XTALI / 2 * mult[sci[VSEMU_SCI_CLOCKF] >> 13];
+		}
+
+		// SCK from the master's SPI registers
+		uint32_t sck() {
+			uint16_t div = (SPCR & 3) == 3 ? 128 : 4 << 2*(SPCR & 3);
+			if(SPSR & (1 << SPI2X)) div >>= 1;
+			return F_CPU / div;
+		}
+
+		uint64_t cycles(uint32_t n, uint32_t hz) {
+			return 1000000000ULL * n / hz;
+		}
+
+		uint16_t fifoFree() {
+			uint64_t now = hostNanos();
+			while(fifoCount && fifo[fifoHead] <= now) {
+				fifoHead = (fifoHead + 1) % (FIFO_SIZE / 2);
+				fifoCount--;
+			}
+			return FIFO_SIZE - 2 * fifoCount - sdiOdd;
+		}
+
+		// A byte clocked in faster than CLKI/4 is sampled a bit late
+		uint8_t clockIn(uint8_t in) {
+			if(sck() <= clki() / 4) return in;
+			clockErrors++;
+			return in >> 1 | 0x80;
+		}
+
+		// SCI reads may run at CLKI/7, writes at CLKI/4
+		uint8_t sciByte(uint8_t in, uint64_t now) {
+			uint8_t pos = sciPos++;
+			uint8_t out = 0xFF;
+
+			if(pos == 0) {
+				sciOp = in;
+				return out;
+			}
+			if(pos == 1) {
+				sciAddr = in & 0x0F;
+				if(sciOp == 0x03) sciData = sciRead();
+				return out;
+			}
+			if(sciOp == 0x03) {
+				if(sck() > clki() / 7) {
+					clockErrors++;
+					return 0xFF;
+				}
+				if(pos == 2) return sciData >> 8;
+				if(pos == 3) return sciData;
+				return out;
+			}
+			if(sciOp != 0x02) return out;
+			in = clockIn(in);
+			if(!(pos & 1)) {
+				sciData = in << 8;
+				return out;
+			}
+			// multiple writes repeat to the same register, each word must
+			// wait for DREQ unless the register executes in no time
+			sciData |= in;
+			if(now < busyUntil) overruns++;
+			sciWrite(sciAddr, sciData, now);
+			if(sciPos == 4) sciPos = 2;
+			return out;
+		}
+
+		uint16_t sciRead() {
+			sciReads++;
+			if(sciAddr == VSEMU_SCI_WRAM) {
+				uint16_t addr = sci[VSEMU_SCI_WRAMADDR]++;
+				return wram[addr];
+			}
+			return sci[sciAddr];
+		}
+
+		void sciWrite(uint8_t addr, uint16_t data, uint64_t now) {
+			sciWrites++;
+			if((addr == VSEMU_SCI_WRAM || addr == VSEMU_SCI_WRAMADDR) && !loadStart) {
+				loadStart = now;
+			}
+			if(addr == VSEMU_SCI_WRAM) {
+				wram[sci[VSEMU_SCI_WRAMADDR]++] = data;
+				wramWords++;
+				busyUntil = now + cycles(timing.sciCycles, clki());
+				return;
+			}
+			sci[addr] = data;
+			if(addr == 0 && (data & VSEMU_SM_RESET)) {
+				hardReset();
+				sci[0] = data & ~VSEMU_SM_RESET;
+				busyUntil = now + timing.bootNanos;
+				return;
+			}
+			if(addr == VSEMU_SCI_CLOCKF) {
+				busyUntil = now + cycles(timing.clockfCycles, XTALI);
+				return;
+			}
+			if(addr == VSEMU_SCI_AIADDR && data && !started) {
+				started = true;
+				loadNanos = now - loadStart;
+			}
+			busyUntil = now + cycles(timing.sciCycles, clki());
+		}
+
+		// SDI may run at CLKI/4
+		void sdiByte(uint8_t in, uint64_t now) {
+			sdiBytes++;
+			in = clockIn(in);
+			if(fifoFree() == 0) {
+				overruns++;
+				return;
+			}
+			if(!sdiOdd) {
+				sdiPad = in;
+				sdiOdd = true;
+				return;
+			}
+			sdiOdd = false;
+			if(!started) {
+				// audio data, drained at once
+				return;
+			}
+			if(sdiPad) padErrors++;
+			fifo[(fifoHead + fifoCount++) % (FIFO_SIZE / 2)] = midiByte(in, now);
+		}
+
+		// Parse one MIDI byte on the DSP, return when it is done
+		uint64_t midiByte(uint8_t b, uint64_t now) {
+			if(parseAt < now) parseAt = now;
+			parseAt += cycles(timing.midiCycles, clki());
+			midiBytes++;
+			midiNanos = parseAt;
+			if(b & 0x80) {
+				// real-time messages don't cancel running status
+				if(b < 0xF8) {
+					midiStatus = b;
+					midiData = 0;
+				}
+				return parseAt;
+			}
+			if(!midiStatus) return parseAt;
+			if(midiData++ == 0) {
+				uint8_t type = midiStatus & 0xF0;
+				if(type == 0xC0 || type == 0xD0) midiData = 0;
+				return parseAt;
+			}
+			midiData = 0;
+			if((midiStatus & 0xF0) == 0x90 && b) {
+				noteOns++;
+				channelNotes[midiStatus & 0x0F]++;
+				noteOnNanos = parseAt;
+			}
+			return parseAt;
+		}
+};
+
+#endif // VSemu_h
@@ -0,0 +1,23 @@
+/* Host build shim for MidiSynth
+ * James Lyden <james@lyden.org>
+ *
+ * The part of the Arduino Print class LCDlite needs.
+ */
+
+#ifndef Print_h
+#define Print_h
+#include <stddef.h>
+#include <stdint.h>
+
+class Print {
+	public:
+		virtual size_t write(uint8_t) = 0;
+		size_t write(const char* str) {
+			size_t n = 0;
+			while(*str) n += write((uint8_t)*str++);
+			return n;
+		}
+		size_t print(const char* str) { return write(str); }
+};
+
+#endif // Print_h
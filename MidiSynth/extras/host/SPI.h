@@ -0,0 +1,53 @@
+/* Host build shim for MidiSynth
+ * James Lyden <james@lyden.org>
+ *
+ * The parts of the Arduino SPI library MidiSynth uses, on the SPI registers
+ * of the SDlite host shim so an attached VSemu sees every byte.
+ */
+
+#ifndef _SPI_H_INCLUDED
+#define _SPI_H_INCLUDED
+#include <Arduino.h>
+
+#define SPI_CLOCK_DIV4 0x00
+#define SPI_CLOCK_DIV16 0x01
+#define SPI_CLOCK_DIV64 0x02
+#define SPI_CLOCK_DIV128 0x03
+#define SPI_CLOCK_DIV2 0x04
+#define SPI_CLOCK_DIV8 0x05
+#define SPI_CLOCK_DIV32 0x06
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+#define SPI_MODE_MASK 0x0C
+#define SPI_CLOCK_MASK 0x03
+#define SPI_2XCLOCK_MASK 0x01
+
+class SPIClass {
+	public:
+		static uint8_t transfer(uint8_t data) {
+			SPDR = data;
+			while(!(SPSR & (1 << SPIF))) ;
+			return SPDR;
+		}
+		static void begin() {
+			SPCR |= (1 << MSTR) | (1 << SPE);
+		}
+		static void end() {
+			SPCR &= ~(1 << SPE);
+		}
+		static void setDataMode(uint8_t mode) {
+			SPCR = (SPCR & ~SPI_MODE_MASK) | mode;
+		}
+		static void setClockDivider(uint8_t rate) {
+			SPCR = (SPCR & ~SPI_CLOCK_MASK) | (rate & SPI_CLOCK_MASK);
+			SPSR = (SPSR & ~SPI_2XCLOCK_MASK) | ((rate >> 2) & SPI_2XCLOCK_MASK);
+		}
+};
+
+static SPIClass SPI __attribute__((unused));
+
+#endif // _SPI_H_INCLUDED
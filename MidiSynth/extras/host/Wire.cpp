@@ -0,0 +1,71 @@
+/* Host build shim for MidiSynth
+ * James Lyden <james@lyden.org>
+ */
+
+#include "Wire.h"
+
+TwoWire Wire;
+
+// I2C bit time at 100 kHz, start and stop take about one more byte
+#define I2C_BIT_NANOS 10000
+
+// The expander: IOCON.BANK = 0 register file and the register pointer
+static uint8_t mcp[0x16] = {0xFF, 0xFF};
+static uint8_t mcpPtr;
+
+static void busTime(uint8_t n) {
+	hostAdvance(9ULL * I2C_BIT_NANOS * (n + 1));
+}
+
+void TwoWire::beginTransmission(uint8_t addr) {
+	txAddr = addr;
+	txLen = 0;
+}
+
+size_t TwoWire::write(uint8_t data) {
+	if(txLen == BUFFER_LENGTH) return 0;
+	tx[txLen++] = data;
+	return 1;
+}
+
+// Returns 0, or 2 for an address nobody acknowledges
+uint8_t TwoWire::endTransmission() {
+	busTime(1 + txLen);
+	bytes += 1 + txLen;
+	if(txAddr != 0x20) return 2;
+	for(uint8_t i = 0; i < txLen; i++) {
+		if(i == 0) {
+			mcpPtr = tx[0] % sizeof(mcp);
+			continue;
+		}
+		// GPIO writes land in the output latch
+		uint8_t reg = mcpPtr == 0x12 || mcpPtr == 0x13 ? mcpPtr + 2 : mcpPtr;
+		mcp[reg] = tx[i];
+		mcpPtr = (mcpPtr + 1) % sizeof(mcp);
+	}
+	return 0;
+}
+
+// GPIO reads give the latch on outputs and the pull-ups, no button
+// pressed, on inputs
+uint8_t TwoWire::requestFrom(uint8_t addr, uint8_t quantity) {
+	if(quantity > BUFFER_LENGTH) quantity = BUFFER_LENGTH;
+	busTime(1 + quantity);
+	bytes += 1 + quantity;
+	rxPos = rxLen = 0;
+	if(addr != 0x20) return 0;
+	while(rxLen < quantity) {
+		uint8_t val = mcp[mcpPtr];
+		if(mcpPtr == 0x12 || mcpPtr == 0x13) {
+			uint8_t dir = mcp[mcpPtr - 0x12];
+			val = (mcp[mcpPtr + 2] & ~dir) | (mcp[mcpPtr - 0x06] & dir);
+		}
+		rx[rxLen++] = val;
+		mcpPtr = (mcpPtr + 1) % sizeof(mcp);
+	}
+	return rxLen;
+}
+
+int TwoWire::read() {
+	return rxPos < rxLen ? rx[rxPos++] : -1;
+}
@@ -0,0 +1,39 @@
+/* Host build shim for MidiSynth
+ * James Lyden <james@lyden.org>
+ *
+ * The Arduino Wire calls LCDlite makes, answered by an MCP23017 at 0x20 as
+ * on the RGB LCD shield.  Transfers block for their time on a 100 kHz bus,
+ * nine clocks a byte with the acknowledge, and move virtual time to match.
+ */
+
+#ifndef TwoWire_h
+#define TwoWire_h
+#include <Arduino.h>
+
+#define BUFFER_LENGTH 32
+
+class TwoWire {
+	public:
+		TwoWire() : bytes(0) {}
+		void begin() {}
+		void beginTransmission(uint8_t addr);
+		size_t write(uint8_t data);
+		uint8_t endTransmission();
+		uint8_t requestFrom(uint8_t addr, uint8_t quantity);
+		int read();
+
+		// bytes on the bus, addresses included
+		uint32_t bytes;
+
+	private:
+		uint8_t txAddr;
+		uint8_t tx[BUFFER_LENGTH];
+		uint8_t txLen;
+		uint8_t rx[BUFFER_LENGTH];
+		uint8_t rxLen;
+		uint8_t rxPos;
+};
+
+extern TwoWire Wire;
+
+#endif // TwoWire_h
@@ -0,0 +1,21 @@
+/* Host build shim for MidiSynth
+ * James Lyden <james@lyden.org>
+ *
+ * Flash is ordinary memory on the host.
+ */
+
+#ifndef __PGMSPACE_H_
+#define __PGMSPACE_H_
+#include <stdint.h>
+
+#ifndef PROGMEM
+#define PROGMEM const
+#endif
+#ifndef pgm_read_byte
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#endif
+#ifndef pgm_read_word
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#endif
+
+#endif // __PGMSPACE_H_
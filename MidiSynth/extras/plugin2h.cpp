@@ -0,0 +1,93 @@
+/* Plugin to flash table converter for MidiSynth
+ * James Lyden <james@lyden.org>
+ *
+ * Turns a VS1053 plugin file, such as rtmidi.053, into a header holding its
+ * words in a PROGMEM table for MidiSynth::begin(table, words), so the synth
+ * can start without an SD card.  The table costs two bytes of flash per
+ * word.  The records are checked before anything is written.
+ *
+ * Build:
+ *   g++ -O2 -o plugin2h extras/plugin2h.cpp
+ *
+ * Usage: plugin2h rtmidi.053 [name] > rtmidi053.h
+ *
+ * then in the sketch:
+ *   #include "rtmidi053.h"
+ *   midiSynth.begin(rtmidi_053, RTMIDI_053_WORDS);
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Check the records of a plugin of n words, return the WRAM words or -1
+static long check(const uint16_t* w, size_t n) {
+	long words = 0;
+	size_t i = 0;
+
+	while(i + 2 <= n) {
+		uint16_t addr = w[i++];
+		uint16_t count = w[i++];
+		if(addr > 0x0F || (count & 0x7FFF) == 0) return -1;
+		if(count & 0x8000) {
+			if(i + 1 > n) return -1;
+			i++;
+		} else {
+			if(i + count > n) return -1;
+			i += count;
+		}
+		if(addr == 0x06) words += count & 0x7FFF;
+	}
+	return i == n ? words : -1;
+}
+
+int main(int argc, char* argv[]) {
+	static uint8_t raw[0x20000];
+	static uint16_t w[0x10000];
+	char name[64];
+	char upper[64];
+	const char* base;
+	size_t size;
+	size_t n;
+	long wram;
+	FILE* fp;
+
+	if(argc < 2 || !(fp = fopen(argv[1], "rb"))) {
+		fprintf(stderr, "usage: plugin2h plugin.053 [name] > plugin.h\n");
+		return 1;
+	}
+	size = fread(raw, 1, sizeof(raw), fp);
+	fclose(fp);
+	n = size / 2;
+	for(size_t i = 0; i < n; i++) w[i] = raw[2 * i] | raw[2 * i + 1] << 8;
+	if((size & 1) || (wram = check(w, n)) < 0) {
+		fprintf(stderr, "%s is not a VS1053 plugin\n", argv[1]);
+		return 1;
+	}
+
+	// C name from the file name unless given
+	base = argc > 2 ? argv[2] : argv[1];
+	if(argc < 3 && strrchr(base, '/')) base = strrchr(base, '/') + 1;
+	for(n = 0; base[n] && n < sizeof(name) - 1; n++) {
+		name[n] = isalnum((uint8_t)base[n]) ? base[n] : '_';
+		upper[n] = toupper((uint8_t)name[n]);
+	}
+	name[n] = upper[n] = 0;
+	if(isdigit((uint8_t)name[0])) name[0] = upper[0] = '_';
+	n = size / 2;
+
+	printf("/* %s as a flash table for MidiSynth::begin(), made by plugin2h\n",
+		argv[1]);
+	printf(" * %lu words, %lu of them to WRAM, %lu bytes of flash\n */\n\n",
+		(unsigned long)n, wram, (unsigned long)size);
+	printf("#ifndef %s_h\n#define %s_h\n#include <MidiSynth.h>\n\n", name, name);
+	printf("#define %s_WORDS %lu\n\n", upper, (unsigned long)n);
+	printf("const uint16_t %s[%s_WORDS] PROGMEM = {", name, upper);
+	for(size_t i = 0; i < n; i++) {
+		printf("%s0x%04X%s", i % 8 ? " " : "\n\t", w[i], i + 1 < n ? "," : "");
+	}
+	printf("\n};\n\n#endif // %s_h\n", name);
+	return 0;
+}
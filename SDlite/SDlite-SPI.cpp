@@ -3,9 +3,11 @@
  */
 
 #include <SDlite-SPI.h>
-// debug trace macro
-#define SD_TRACE(m, b)
-// #define SD_TRACE(m, b) Serial.print(m);Serial.println(b);
+#include <SDlite-prof.h>
+#if USE_SD_PROFILE
+// startup stage timestamps
+uint32_t sdStageStamp[SD_STAGE_COUNT];
+#endif  // USE_SD_PROFILE
 
 // SPI functions
 //==============================================================================
@@ -84,6 +86,8 @@ static void spiSend(const uint8_t* buf , size_t n) {
 //==============================================================================
 // SDspi member functions
 //------------------------------------------------------------------------------
+volatile bool SDspi::busBusy_ = false;  // SPI bus owned by a card transfer
+//------------------------------------------------------------------------------
 // send command and return error code.  Return zero for OK
 uint8_t SDspi::cardCommand(uint8_t cmd, uint32_t arg) {
   // select card
@@ -126,13 +130,21 @@ void SDspi::chipSelectHigh() {
   digitalWrite(chipSelectPin_, HIGH);
   // insure MISO goes high impedance
   spiSend(0XFF);
+  busBusy_ = false;
 }
 //------------------------------------------------------------------------------
 void SDspi::chipSelectLow() {
+  busBusy_ = true;
   spiInit(spiRate_);
   digitalWrite(chipSelectPin_, LOW);
 }
 //------------------------------------------------------------------------------
+// initPoll() states
+uint8_t const INIT_CMD0 = 1;
+uint8_t const INIT_CMD8 = 2;
+uint8_t const INIT_ACMD41 = 3;
+uint8_t const INIT_DONE = 4;
+//------------------------------------------------------------------------------
 /**
  * Initialize an SD flash memory card.
  *
@@ -144,11 +156,28 @@ void SDspi::chipSelectLow() {
  * can be determined by calling errorCode() and errorData().
  */
 bool SDspi::init(uint8_t sckRateID, uint8_t chipSelectPin) {
+  int8_t rtn;
+  initStart(sckRateID, chipSelectPin);
+  while ((rtn = initPoll()) == SD_POLL_BUSY) {}
+  return rtn == SD_POLL_DONE;
+}
+//------------------------------------------------------------------------------
+/**
+ * Start a card initialization that initPoll() finishes, so the wait for
+ * the card can be spent on other devices.
+ *
+ * \param[in] sckRateID SPI clock rate selector. See setSckRate().
+ * \param[in] chipSelectPin SD chip select pin number.
+ */
+void SDspi::initStart(uint8_t sckRateID, uint8_t chipSelectPin) {
   errorCode_ = type_ = 0;
   chipSelectPin_ = chipSelectPin;
+  initRate_ = sckRateID;
   // 16-bit init start time allows over a minute
-  uint16_t t0 = (uint16_t)millis();
-  uint32_t arg;
+  initT0_ = (uint16_t)millis();
+#if USE_SD_PROFILE
+  for (uint8_t i = 0; i < SD_STAGE_COUNT; i++) SD_PROFILE(i);
+#endif  // USE_SD_PROFILE
 
   pinMode(chipSelectPin_, OUTPUT);
   digitalWrite(chipSelectPin_, HIGH);
@@ -156,70 +185,127 @@ bool SDspi::init(uint8_t sckRateID, uint8_t chipSelectPin) {
 
   // set SCK rate for initialization commands
   spiRate_ = SPI_SD_INIT_RATE;
+  busBusy_ = true;
   spiInit(spiRate_);
 
   // must supply min of 74 clock cycles with CS high.
   for (uint8_t i = 0; i < 10; i++) spiSend(0XFF);
+  busBusy_ = false;
+  initState_ = INIT_CMD0;
+}
+//------------------------------------------------------------------------------
+/**
+ * Send the next initialization command.  The card is deselected between
+ * calls so other devices may use the bus.
+ *
+ * \return SD_POLL_BUSY until the card is ready, then SD_POLL_DONE.
+ * SD_POLL_FAIL is returned on failure, see errorCode(), or if
+ * initStart() was not called.
+ */
+int8_t SDspi::initPoll() {
+  bool timeout = ((uint16_t)millis() - initT0_) > SD_INIT_TIMEOUT;
+  uint32_t arg;
 
-  // command to go idle in SPI mode
-  while (cardCommand(CMD0, 0) != R1_IDLE_STATE) {
-    if (((uint16_t)millis() - t0) > SD_INIT_TIMEOUT) {
-      error(SD_CARD_ERROR_CMD0);
-      goto fail;
-    }
-  }
+  switch (initState_) {
+    case INIT_CMD0:
+      // command to go idle in SPI mode
+      if (cardCommand(CMD0, 0) != R1_IDLE_STATE) {
+        if (timeout) {
+          error(SD_CARD_ERROR_CMD0);
+          goto fail;
+        }
+        break;
+      }
+      SD_PROFILE(SD_STAGE_CMD0);
 #if USE_SD_CRC
-  if (cardCommand(CMD59, 1) != R1_IDLE_STATE) {
-    error(SD_CARD_ERROR_CMD59);
-    goto fail;
-  }
+      if (cardCommand(CMD59, 1) != R1_IDLE_STATE) {
+        error(SD_CARD_ERROR_CMD59);
+        goto fail;
+      }
 #endif  // USE_SD_CRC
-  // check SD version
-  while (1) {
-    if (cardCommand(CMD8, 0x1AA) == (R1_ILLEGAL_COMMAND | R1_IDLE_STATE)) {
-      type(SD_CARD_TYPE_SD1);
+      initState_ = INIT_CMD8;
       break;
-    }
-    for (uint8_t i = 0; i < 4; i++) status_ = spiRec();
-    if (status_ == 0XAA) {
-      type(SD_CARD_TYPE_SD2);
+
+    case INIT_CMD8:
+      // check SD version
+      if (cardCommand(CMD8, 0x1AA) == (R1_ILLEGAL_COMMAND | R1_IDLE_STATE)) {
+        type(SD_CARD_TYPE_SD1);
+      } else {
+        for (uint8_t i = 0; i < 4; i++) status_ = spiRec();
+        if (status_ == 0XAA) type(SD_CARD_TYPE_SD2);
+      }
+      if (type()) {
+        initState_ = INIT_ACMD41;
+      } else if (timeout) {
+        error(SD_CARD_ERROR_CMD8);
+        goto fail;
+      }
       break;
-    }
-    if (((uint16_t)millis() - t0) > SD_INIT_TIMEOUT) {
-      error(SD_CARD_ERROR_CMD8);
-      goto fail;
-    }
-  }
-  // initialize card and send host supports SDHC if SD2
-  arg = type() == SD_CARD_TYPE_SD2 ? 0X40000000 : 0;
 
-  while (cardAcmd(ACMD41, arg) != R1_READY_STATE) {
-    // check for timeout
-    if (((uint16_t)millis() - t0) > SD_INIT_TIMEOUT) {
-      error(SD_CARD_ERROR_ACMD41);
-      goto fail;
-    }
-  }
-  // if SD2 read OCR register to check for SDHC card
-  if (type() == SD_CARD_TYPE_SD2) {
-    if (cardCommand(CMD58, 0)) {
-      error(SD_CARD_ERROR_CMD58);
-      goto fail;
-    }
-    if ((spiRec() & 0XC0) == 0XC0) type(SD_CARD_TYPE_SDHC);
-    // discard rest of ocr - contains allowed voltage range
-    for (uint8_t i = 0; i < 3; i++) spiRec();
-  }
-  chipSelectHigh();
+    case INIT_ACMD41:
+      // initialize card and send host supports SDHC if SD2
+      arg = type() == SD_CARD_TYPE_SD2 ? 0X40000000 : 0;
+      if (cardAcmd(ACMD41, arg) != R1_READY_STATE) {
+        if (timeout) {
+          error(SD_CARD_ERROR_ACMD41);
+          goto fail;
+        }
+        break;
+      }
+      SD_PROFILE(SD_STAGE_ACMD41);
+      // if SD2 read OCR register to check for SDHC card
+      if (type() == SD_CARD_TYPE_SD2) {
+        if (cardCommand(CMD58, 0)) {
+          error(SD_CARD_ERROR_CMD58);
+          goto fail;
+        }
+        if ((spiRec() & 0XC0) == 0XC0) type(SD_CARD_TYPE_SDHC);
+        // discard rest of ocr - contains allowed voltage range
+        for (uint8_t i = 0; i < 3; i++) spiRec();
+      }
+      chipSelectHigh();
+      initState_ = INIT_DONE;
 #ifndef SOFTWARE_SPI
-  return setSckRate(sckRateID);
-#else  // SOFTWARE_SPI
-  return true;
+      if (!setSckRate(initRate_)) {
+        initState_ = 0;
+        return SD_POLL_FAIL;
+      }
 #endif  // SOFTWARE_SPI
+      return SD_POLL_DONE;
+
+    case INIT_DONE:
+      return SD_POLL_DONE;
+
+    default:
+      return SD_POLL_FAIL;
+  }
+  chipSelectHigh();
+  return SD_POLL_BUSY;
 
  fail:
+  initState_ = 0;
   chipSelectHigh();
-  return false;
+  return SD_POLL_FAIL;
+}
+//------------------------------------------------------------------------------
+/** Allocation unit size from the AU_SIZE field of the SD Status register.
+ *
+ * \return The allocation unit in 512 byte blocks or zero if the card
+ * doesn't report it.
+ */
+uint32_t SDspi::auBlocks() {
+  uint8_t status[64];
+  uint8_t au;
+
+  if (type() == SD_CARD_TYPE_SD1 || !readStatus(status)) return 0;
+  // bits 431:428
+  au = status[10] >> 4;
+  if (au == 0) return 0;
+  // 16 KB doubling to 8 MB
+  if (au <= 0XA) return 32UL << (au - 1);
+  // 12, 16, 24, 32 and 64 MB
+  if (au == 0XF) return 131072UL;
+  return (au & 1 ? 24576UL : 32768UL) << ((au - 0XB) >> 1);
 }
 //------------------------------------------------------------------------------
 /**
@@ -232,7 +318,6 @@ bool SDspi::init(uint8_t sckRateID, uint8_t chipSelectPin) {
  * the value zero, false, is returned for failure.
  */
 bool SDspi::readBlock(uint32_t blockNumber, uint8_t* dst) {
-  SD_TRACE("RB", blockNumber);
   // use address if not SDHC card
   if (type()!= SD_CARD_TYPE_SDHC) blockNumber <<= 9;
   if (cardCommand(CMD17, blockNumber)) {
@@ -246,6 +331,51 @@ bool SDspi::readBlock(uint32_t blockNumber, uint8_t* dst) {
   return false;
 }
 //------------------------------------------------------------------------------
+/**
+ * Read contiguous 512 byte blocks with a single multiple block read.
+ *
+ * \param[in] block Logical block to be read first.
+ * \param[out] dst Pointer to the location that will receive the data.
+ * \param[in] count Number of blocks to be read.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+bool SDspi::readBlocks(uint32_t block, uint8_t* dst, size_t count) {
+  if (count == 1) return readBlock(block, dst);
+  if (!readStart(block)) return false;
+  for (size_t b = 0; b < count; b++, dst += 512) {
+    if (!readData(dst)) return false;
+  }
+  return readStop();
+}
+//------------------------------------------------------------------------------
+/**
+ * Read a run of contiguous blocks, such as an SDextent from
+ * SDfile::extents(), with one multiple block command.
+ *
+ * \param[in] block First block of the run.
+ * \param[in] count Number of blocks.
+ * \param[out] buf Buffer for the first block.
+ * \param[in] callback Called after each block with the buffer it was read
+ *  into.  It returns the buffer for the next block or null to end the run.
+ *  If null the blocks are read into consecutive 512 byte parts of \a buf.
+ * \param[in] context Passed to \a callback.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+bool SDspi::readRun(uint32_t block, uint32_t count, uint8_t* buf,
+  SDrunCallback callback, void* context) {
+  if (!readStart(block)) return false;
+  while (count--) {
+    if (!readData(buf)) return false;
+    buf = callback ? callback(buf, context) : buf + 512;
+    if (!buf) break;
+  }
+  return readStop();
+}
+//------------------------------------------------------------------------------
 /** Read one data block in a multiple block read sequence
  *
  * \param[in] dst Pointer to the location for the data to be read.
@@ -294,6 +424,27 @@ bool SDspi::readData(uint8_t* dst, size_t count) {
   return false;
 }
 //------------------------------------------------------------------------------
+/** Read the 64 byte SD Status register with ACMD13.
+ *
+ * \param[out] status Pointer to the location for the register.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+bool SDspi::readStatus(uint8_t* status) {
+  if (cardAcmd(ACMD13, 0)) {
+    error(SD_CARD_ERROR_ACMD13);
+    goto fail;
+  }
+  // second byte of the R2 response
+  spiRec();
+  return readData(status, 64);
+
+ fail:
+  chipSelectHigh();
+  return false;
+}
+//------------------------------------------------------------------------------
 /** Start a read multiple blocks sequence.
  *
  * \param[in] blockNumber Address of first block in sequence.
@@ -305,7 +456,6 @@ bool SDspi::readData(uint8_t* dst, size_t count) {
  * the value zero, false, is returned for failure.
  */
 bool SDspi::readStart(uint32_t blockNumber) {
-  SD_TRACE("RS", blockNumber);
   if (type()!= SD_CARD_TYPE_SDHC) blockNumber <<= 9;
   if (cardCommand(CMD18, blockNumber)) {
     error(SD_CARD_ERROR_CMD18);
@@ -383,7 +533,6 @@ bool SDspi::waitNotBusy(uint16_t timeoutMillis) {
  * the value zero, false, is returned for failure.
  */
 bool SDspi::writeBlock(uint32_t blockNumber, const uint8_t* src) {
-  SD_TRACE("WB", blockNumber);
   // use address if not SDHC card
   if (type() != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
   if (cardCommand(CMD24, blockNumber)) {
@@ -410,6 +559,25 @@ bool SDspi::writeBlock(uint32_t blockNumber, const uint8_t* src) {
   return false;
 }
 //------------------------------------------------------------------------------
+/**
+ * Write contiguous 512 byte blocks with a single multiple block write.
+ *
+ * \param[in] block Logical block to be written first.
+ * \param[in] src Pointer to the location of the data to be written.
+ * \param[in] count Number of blocks to be written.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+bool SDspi::writeBlocks(uint32_t block, const uint8_t* src, size_t count) {
+  if (count == 1) return writeBlock(block, src);
+  if (!writeStart(block, count)) return false;
+  for (size_t b = 0; b < count; b++, src += 512) {
+    if (!writeData(src)) return false;
+  }
+  return writeStop();
+}
+//------------------------------------------------------------------------------
 /** Write one data block in a multiple block write sequence
  * \param[in] src Pointer to the location of the data to be written.
  * \return The value one, true, is returned for success and
@@ -453,3 +621,53 @@ bool SDspi::writeData(uint8_t token, const uint8_t* src) {
   chipSelectHigh();
   return false;
 }
+//------------------------------------------------------------------------------
+/** Start a write multiple blocks sequence.
+ *
+ * \param[in] blockNumber Address of first block in sequence.
+ * \param[in] eraseCount The number of blocks to be pre-erased.
+ *
+ * \note This function is used with writeData() and writeStop()
+ * for optimized multiple block writes.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+bool SDspi::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
+  // send pre-erase count
+  if (cardAcmd(ACMD23, eraseCount)) {
+    error(SD_CARD_ERROR_ACMD23);
+    goto fail;
+  }
+  // use address if not SDHC card
+  if (type() != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
+  if (cardCommand(CMD25, blockNumber)) {
+    error(SD_CARD_ERROR_CMD25);
+    goto fail;
+  }
+  chipSelectHigh();
+  return true;
+
+ fail:
+  chipSelectHigh();
+  return false;
+}
+//------------------------------------------------------------------------------
+/** End a write multiple blocks sequence.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+bool SDspi::writeStop() {
+  chipSelectLow();
+  if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
+  spiSend(STOP_TRAN_TOKEN);
+  if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
+  chipSelectHigh();
+  return true;
+
+ fail:
+  error(SD_CARD_ERROR_STOP_TRAN);
+  chipSelectHigh();
+  return false;
+}
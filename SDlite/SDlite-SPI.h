@@ -6,6 +6,7 @@
 #define SDliteSPI_h
 #include <Arduino.h>
 #include <SDlite-config.h>
+#include <SDlite-dev.h>
 #include <SDlite-info.h>
 
 //------------------------------------------------------------------------------
@@ -36,6 +37,14 @@ uint16_t const SD_READ_TIMEOUT = 300;
 /** write time out ms */
 uint16_t const SD_WRITE_TIMEOUT = 600;
 //------------------------------------------------------------------------------
+// SDspi::initPoll() and SD::beginPoll() results
+/** initialization still in progress, poll again */
+int8_t const SD_POLL_BUSY = 0;
+/** initialization done */
+int8_t const SD_POLL_DONE = 1;
+/** initialization failed, see SDspi::errorCode() */
+int8_t const SD_POLL_FAIL = -1;
+//------------------------------------------------------------------------------
 // SD card errors
 /** timeout error for command CMD0 (initialize card in SPI mode) */
 uint8_t const SD_CARD_ERROR_CMD0 = 0X1;
@@ -93,6 +102,8 @@ uint8_t const SD_CARD_ERROR_CMD59 = 0X1A;
 uint8_t const SD_CARD_ERROR_READ_CRC = 0X1B;
 /** SPI DMA error */
 uint8_t const SD_CARD_ERROR_SPI_DMA = 0X1C;
+/** card returned an error response for ACMD13 (read SD status) */
+uint8_t const SD_CARD_ERROR_ACMD13 = 0X1D;
 //------------------------------------------------------------------------------
 // card types
 /** Standard capacity V1 SD card */
@@ -105,10 +116,11 @@ uint8_t const SD_CARD_TYPE_SDHC = 3;
 /** The default chip select pin for the SD card is SS. */
 uint8_t const  SD_CHIP_SELECT_PIN = SS;
 //------------------------------------------------------------------------------
-class SDspi {
+class SDspi : public SDdev {
  public:
   /** Construct an instance of SDspi. */
-  SDspi() : errorCode_(SD_CARD_ERROR_INIT_NOT_CALLED), type_(0) {}
+  SDspi() : errorCode_(SD_CARD_ERROR_INIT_NOT_CALLED), initState_(0),
+    type_(0) {}
   void error(uint8_t code) {errorCode_ = code;}
   int errorCode() const {return errorCode_;}
   int errorData() const {return status_;}
@@ -116,21 +128,43 @@ class SDspi {
    * Initialize an SD flash memory card with default clock rate and chip
    * select pin.  See sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin).
    */
+  uint32_t auBlocks();
   bool init(uint8_t sckRateID = SPI_FULL_SPEED,
     uint8_t chipSelectPin = SD_CHIP_SELECT_PIN);
+  void initStart(uint8_t sckRateID = SPI_FULL_SPEED,
+    uint8_t chipSelectPin = SD_CHIP_SELECT_PIN);
+  int8_t initPoll();
   bool readBlock(uint32_t block, uint8_t* dst);
+  bool readBlocks(uint32_t block, uint8_t* dst, size_t count);
   bool readData(uint8_t *dst);
+  bool readRun(uint32_t block, uint32_t count, uint8_t* buf,
+    SDrunCallback callback = 0, void* context = 0);
   bool readStart(uint32_t blockNumber);
+  bool readStatus(uint8_t* status);
   bool readStop();
   int type() const {return type_;}
   bool writeBlock(uint32_t blockNumber, const uint8_t* src);
+  bool writeBlocks(uint32_t block, const uint8_t* src, size_t count);
   bool writeData(const uint8_t* src);
+  bool writeStart(uint32_t blockNumber, uint32_t eraseCount);
+  bool writeStop();
   bool setSckRate(uint8_t sckRateID);
+  /**
+   * \return true while a card transfer owns the SPI bus, from chip select
+   * low until after the byte clocked once it goes high.  Interrupt handlers
+   * that share the bus must leave it alone meanwhile: a chip select pin
+   * being high does not mean no byte is in flight.
+   */
+  static bool busBusy() {return busBusy_;}
 
  private:
   //----------------------------------------------------------------------------
+  static volatile bool busBusy_;
   uint8_t chipSelectPin_;
   uint8_t errorCode_;
+  uint8_t initRate_;
+  uint8_t initState_;
+  uint16_t initT0_;
   uint8_t spiRate_;
   uint8_t status_;
   uint8_t type_;
@@ -18,6 +18,67 @@
 #define USE_MULTI_BLOCK_SD_IO 1
 #endif
 //------------------------------------------------------------------------------
+// separate 512 byte cache block for files read with SDfile::setStream()
+#if defined(RAMEND) && RAMEND < 3000
+#define USE_STREAM_CACHE 0
+#else
+#define USE_STREAM_CACHE 1
+#endif
+//------------------------------------------------------------------------------
+// SDfile::setReadAhead() and SDfile::poll() - adds 16 bytes to each SDfile
+#if defined(RAMEND) && RAMEND < 3000
+#define USE_READ_AHEAD 0
+#else
+#define USE_READ_AHEAD 1
+#endif
+//------------------------------------------------------------------------------
+// SDfile::logBegin() and SDfile::logWrite() - adds 25 bytes to each SDfile
+#if defined(RAMEND) && RAMEND < 3000
+#define USE_LOG_MODE 0
+#else
+#define USE_LOG_MODE 1
+#endif
+//------------------------------------------------------------------------------
+// SD allocation unit in blocks for aligned allocation, see
+// SDvol::setAllocUnit().  Zero to read it from the card with ACMD13 when the
+// first log starts.
+#define SD_AU_BLOCKS 0
+//------------------------------------------------------------------------------
+// read FAT_PREFETCH_BLOCKS FAT blocks at once when SDvol::fatGet() follows a
+// cluster chain into a block that is not cached - 512 bytes per block
+#if defined(RAMEND) && RAMEND < 3000
+#define USE_FAT_PREFETCH 0
+#else
+#define USE_FAT_PREFETCH 1
+#endif
+#define FAT_PREFETCH_BLOCKS 2
+//------------------------------------------------------------------------------
+// count cache lookups and misses, see SDvol::cacheStats()
+// may be set on the compiler command line for host builds
+#ifndef USE_CACHE_STATS
+#define USE_CACHE_STATS 0
+#endif  // USE_CACHE_STATS
+//------------------------------------------------------------------------------
+// record block I/O and cache lookups in a ring of SD_TRACE_SIZE five byte
+// entries, see SDvol::traceDump() - may be set on the compiler command line
+#ifndef USE_SD_TRACE
+#define USE_SD_TRACE 0
+#endif  // USE_SD_TRACE
+#ifndef SD_TRACE_SIZE
+#define SD_TRACE_SIZE 64
+#endif  // SD_TRACE_SIZE
+//------------------------------------------------------------------------------
+// cache paths resolved by SDfile::open() - 26 bytes per entry
+#if defined(RAMEND) && RAMEND < 3000
+#define USE_DENTRY_CACHE 0
+#else
+#define USE_DENTRY_CACHE 1
+#endif
+#define DENTRY_CACHE_SIZE 8
+//------------------------------------------------------------------------------
+// open() and openNext() match and return VFAT long names - flash cost only
+#define USE_LONG_FILE_NAMES 1
+//------------------------------------------------------------------------------
 #define USE_ARDUINO_SPI_LIBRARY 0
 //------------------------------------------------------------------------------
 #if defined(__arm__) && defined(CORE_TEENSY)
@@ -41,6 +102,11 @@
 #define ALLOW_DEPRECATED_FUNCTIONS 0
 #define FAT12_SUPPORT 0
 //------------------------------------------------------------------------------
+// record a micros() timestamp at the end of each SD::begin() stage
+#ifndef USE_SD_PROFILE
+#define USE_SD_PROFILE 0
+#endif  // USE_SD_PROFILE
+//------------------------------------------------------------------------------
 #define SPI_SD_INIT_RATE 11
 //------------------------------------------------------------------------------
 #define MEGA_SOFT_SPI 0
@@ -0,0 +1,65 @@
+/* Stripped-down version of Arduino SD Library
+ * James Lyden <james@lyden.org>
+ */
+
+#ifndef SDlitedev_h
+#define SDlitedev_h
+#include <stddef.h>
+#include <stdint.h>
+//------------------------------------------------------------------------------
+/**
+ * Called by SDdev::readRun() after each block is read into \a buf.
+ * \return The buffer for the next block or null to end the run early.
+ */
+typedef uint8_t* (*SDrunCallback)(uint8_t* buf, void* context);
+//------------------------------------------------------------------------------
+/**
+ * \class SDdev
+ * \brief Block device interface used by SDvol.
+ *
+ * All transfers are in 512 byte blocks.  SDspi is the hardware backend;
+ * SDram and the host image backend in extras/ allow the FAT layer to be
+ * run and profiled without SPI costs.  A device may wrap another device
+ * to add caching or instrumentation.
+ */
+class SDdev {
+ public:
+  /** \return Allocation unit size in blocks or zero if not known. */
+  virtual uint32_t auBlocks() {return 0;}
+  virtual bool readBlock(uint32_t block, uint8_t* dst) = 0;
+  virtual bool readBlocks(uint32_t block, uint8_t* dst, size_t count);
+  virtual bool readRun(uint32_t block, uint32_t count, uint8_t* buf,
+    SDrunCallback callback = 0, void* context = 0);
+  virtual bool writeBlock(uint32_t block, const uint8_t* src) = 0;
+  virtual bool writeBlocks(uint32_t block, const uint8_t* src, size_t count);
+  /** Finish any buffered writes.  \return true for success. */
+  virtual bool sync() {return true;}
+};
+//------------------------------------------------------------------------------
+/** Read \a count contiguous blocks.  Default is one readBlock() per block. */
+inline bool SDdev::readBlocks(uint32_t block, uint8_t* dst, size_t count) {
+  for (size_t i = 0; i < count; i++, dst += 512) {
+    if (!readBlock(block + i, dst)) return false;
+  }
+  return true;
+}
+/** Read up to \a count contiguous blocks, each into the buffer \a callback
+ * returns for it.  Default is one readBlock() per block.
+ */
+inline bool SDdev::readRun(uint32_t block, uint32_t count, uint8_t* buf,
+  SDrunCallback callback, void* context) {
+  for (; count && buf; count--, block++) {
+    if (!readBlock(block, buf)) return false;
+    buf = callback ? callback(buf, context) : buf + 512;
+  }
+  return true;
+}
+/** Write \a count contiguous blocks.  Default is one writeBlock() per block. */
+inline bool SDdev::writeBlocks(uint32_t block,
+  const uint8_t* src, size_t count) {
+  for (size_t i = 0; i < count; i++, src += 512) {
+    if (!writeBlock(block + i, src)) return false;
+  }
+  return true;
+}
+#endif  // SDlitedev_h
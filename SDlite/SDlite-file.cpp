@@ -82,10 +82,462 @@ dir_t* SDfile::cacheDirEntry(uint8_t action) {
  */
 bool SDfile::close() {
   bool rtn = sync();
+#if USE_LOG_MODE
+  if (logBuf_) {
+    // stop logging so sync() doesn't rewrite the last partial block
+    logBuf_ = 0;
+    if (!logTrim() || !sync()) rtn = false;
+  }
+#endif  // USE_LOG_MODE
   type_ = FAT_FILE_TYPE_CLOSED;
   return rtn;
 }
 //------------------------------------------------------------------------------
+/** Get the device blocks holding the file as runs of contiguous blocks.
+ *  The runs may be read with SDdev::readBlocks() or SDdev::readRun() with
+ *  no FAT or cache work.  Call sync() first if the file has been written.
+ *
+ *  The file position is left at the end of the runs so a long list can
+ *  be fetched in parts without following the chain from the start.
+ *
+ * \param[out] ext Array for the runs.
+ * \param[in] maxExtents Number of elements in \a ext.
+ * \param[in] startBlock Block of the file where the first run starts.  Pass
+ *  the total of the counts returned so far to continue a long list.
+ *
+ * \return The number of runs, zero past the end of the file or if
+ *  \a maxExtents is zero, or -1 for an error.
+ */
+int SDfile::extents(SDextent* ext, uint8_t maxExtents, uint32_t startBlock) {
+  uint32_t block;
+  uint32_t cluster;
+  uint32_t count;
+  uint32_t last;
+  uint32_t left;
+  uint32_t next;
+  uint32_t pos;
+  uint8_t mask;
+  uint8_t n = 0;
+
+  if (type_ != FAT_FILE_TYPE_NORMAL) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // file blocks from startBlock to end of file
+  left = (fileSize_ + 511) >> 9;
+  if (startBlock >= left || maxExtents == 0) return 0;
+  left -= startBlock;
+
+  // seekSet() leaves curCluster_ on the cluster before a cluster boundary
+  pos = startBlock << 9;
+  if (!seekSet(pos)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  mask = vol_->blocksPerCluster_ - 1;
+  if (pos == 0) {
+    cluster = firstCluster_;
+  } else if ((startBlock & mask) == 0) {
+    if (!vol_->fatGet(curCluster_, &cluster) || vol_->isEOC(cluster)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+  } else {
+    cluster = curCluster_;
+  }
+  block = vol_->clusterStartBlock(cluster) + (startBlock & mask);
+  count = vol_->blocksPerCluster_ - (startBlock & mask);
+  while (1) {
+    // extend the run while the chain is contiguous
+    last = cluster;
+    while (count < left) {
+      if (!vol_->fatGet(last, &next) || vol_->isEOC(next)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      if (next != last + 1) break;
+      last = next;
+      count += vol_->blocksPerCluster_;
+    }
+    if (count > left) count = left;
+    ext[n].block = block;
+    ext[n].count = count;
+    n++;
+    pos += count << 9;
+    left -= count;
+    if (left == 0 || n == maxExtents) break;
+    cluster = next;
+    block = vol_->clusterStartBlock(cluster);
+    count = vol_->blocksPerCluster_;
+  }
+  // position at the end of the runs
+  curCluster_ = last;
+  curPosition_ = pos < fileSize_ ? pos : fileSize_;
+  return n;
+
+ fail:
+  return -1;
+}
+//------------------------------------------------------------------------------
+/** Fill \a handle with the location of this file's directory entry.
+ *  The root directory has no entry and can't be saved.
+ */
+bool SDfile::getHandle(SDhandle* handle) const {
+  if (!isOpen() || isRoot()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  handle->volSig = vol_->signature();
+  handle->dirBlock = dirBlock_;
+  handle->dirIndex = dirIndex_;
+  handle->firstCluster = firstCluster_;
+  handle->fileSize = fileSize_;
+  return true;
+
+ fail:
+  return false;
+}
+#if USE_DENTRY_CACHE
+static bool entryHasName(const dir_t* dir, uint8_t index,
+  const uint8_t dname[11], const char* lname, uint8_t lnameLen);
+//------------------------------------------------------------------------------
+// remember the location of this open file for path hash in start directory,
+// and the first cluster of the directory it was found in
+void SDfile::dentryAdd(uint32_t start, uint32_t hash, uint32_t parent) const {
+  dentry_t* de = dentryFind(start, hash);
+  if (!de) {
+    de = &SDvol::dentry_[SDvol::dentryNext_];
+    if (++SDvol::dentryNext_ >= DENTRY_CACHE_SIZE) SDvol::dentryNext_ = 0;
+  }
+  de->hash = hash;
+  de->startCluster = start;
+  de->parentCluster = parent;
+  de->dirBlock = dirBlock_;
+  de->firstCluster = firstCluster_;
+  de->size = fileSize_;
+  de->dirIndex = dirIndex_;
+  de->isDir = isDir();
+}
+//------------------------------------------------------------------------------
+dentry_t* SDfile::dentryFind(uint32_t start, uint32_t hash) {
+  for (uint8_t i = 0; i < DENTRY_CACHE_SIZE; i++) {
+    dentry_t* de = &SDvol::dentry_[i];
+    if (de->hash == hash && de->startCluster == start) return de;
+  }
+  return 0;
+}
+//------------------------------------------------------------------------------
+// FNV-1a hash of '/' and a path component, ASCII case ignored
+uint32_t SDfile::dentryHash(uint32_t hash, const char* name, uint8_t len) {
+  hash = (hash ^ '/')*16777619UL;
+  for (uint8_t i = 0; i < len; i++) {
+    uint8_t c = name[i];
+    if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+    hash = (hash ^ c)*16777619UL;
+  }
+  // zero marks an unused cache entry
+  return hash ? hash : 1;
+}
+//------------------------------------------------------------------------------
+// open from a dentry cache entry, after checking the entry still holds the
+// name: two paths can share a hash, so a hit costs the directory block
+bool SDfile::openDentry(SDvol* vol, const dentry_t* de, const uint8_t dname[11],
+  const char* lname, uint8_t lnameLen, uint8_t oflag) {
+  SDhandle handle;
+  cache_t* pc;
+  dir_t* p;
+
+  // don't open existing file if O_EXCL
+  if (oflag & O_EXCL) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  pc = vol->cacheFetch(de->dirBlock, SDvol::CACHE_FOR_READ);
+  if (!pc || !entryHasName(pc->dir, de->dirIndex, dname, lname, lnameLen)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (!de->isDir) {
+    // checks the directory entry still describes the file
+    handle.volSig = vol->signature();
+    handle.dirBlock = de->dirBlock;
+    handle.firstCluster = de->firstCluster;
+    handle.fileSize = de->size;
+    handle.dirIndex = de->dirIndex;
+    return open(vol, &handle, oflag);
+  }
+  p = pc->dir + de->dirIndex;
+  if (!DIR_IS_SUBDIR(p) || de->firstCluster
+    != ((uint32_t)p->firstClusterHigh << 16 | p->firstClusterLow)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  // directories are read only, the size is cached
+  if (isOpen() || (oflag & (O_WRITE | O_TRUNC))) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  vol_ = vol;
+  dirBlock_ = de->dirBlock;
+  dirIndex_ = de->dirIndex;
+  firstCluster_ = de->firstCluster;
+  fileSize_ = de->size;
+  type_ = FAT_FILE_TYPE_SUBDIR;
+  flags_ = oflag & F_OFLAG;
+  curCluster_ = 0;
+  curPosition_ = 0;
+#if USE_READ_AHEAD
+  raBuf_ = 0;
+#endif  // USE_READ_AHEAD
+#if USE_LOG_MODE
+  logBuf_ = 0;
+#endif  // USE_LOG_MODE
+  return oflag & O_AT_END ? seekEnd(0) : true;
+
+ fail:
+  return false;
+}
+#endif  // USE_DENTRY_CACHE
+//------------------------------------------------------------------------------
+#if USE_LOG_MODE
+/** Start append-only logging on a new or empty file opened for write.
+ *  Clusters are preallocated \a prealloc bytes at a time as one contiguous
+ *  group, so logWrite() does no FAT work until a group is full.  Records
+ *  are collected in \a buf and written \a nBlocks blocks at a time with one
+ *  multiple block write.  The directory entry's size is written after
+ *  every \a syncBlocks blocks, by sync() and by close().
+ *
+ *  After a power loss the file ends at the last size written, so at most
+ *  nBlocks*512 bytes in the buffer plus syncBlocks*512 bytes written since
+ *  the last update are lost.  Clusters preallocated past the end stay
+ *  allocated until a disk check frees them.  close() frees them.
+ *
+ *  If SDvol::allocUnit() is set each group starts on an allocation unit
+ *  boundary and is rounded up to whole units, and no write crosses a unit
+ *  boundary, so the card sees each unit written in order from its start.
+ *
+ * \param[in] buf Block buffer, nBlocks*512 bytes, owned by the file until
+ *  close().
+ * \param[in] nBlocks Buffer size in blocks, 1 to 127.
+ * \param[in] prealloc Bytes to preallocate at a time, rounded up to whole
+ *  clusters.
+ * \param[in] syncBlocks Blocks written between directory entry updates.
+ *
+ * \return true for success or false for failure.
+ */
+bool SDfile::logBegin(uint8_t* buf, uint8_t nBlocks, uint32_t prealloc,
+  uint16_t syncBlocks) {
+  uint8_t shift;
+
+  if (type_ != FAT_FILE_TYPE_NORMAL || !(flags_ & O_WRITE) || fileSize_
+    || firstCluster_ || !buf || nBlocks == 0 || nBlocks > 127
+    || syncBlocks == 0) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  shift = 9 + vol_->clusterSizeShift_;
+  logExtent_ = (prealloc + (1UL << shift) - 1) >> shift;
+  if (logExtent_ == 0) logExtent_ = 1;
+  if (vol_->allocUnit() >= vol_->blocksPerCluster_) {
+    // whole allocation units
+    uint32_t au = vol_->auBlocks_ >> vol_->clusterSizeShift_;
+    logExtent_ = (logExtent_ + au - 1)/au*au;
+  }
+  logBlocks_ = nBlocks;
+  logSyncBlocks_ = syncBlocks;
+  logFill_ = 0;
+  logUnsynced_ = 0;
+  logCluster_ = 0;
+  if (!logExtend()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  logBuf_ = buf;
+  curPosition_ = 0;
+  // write the chain and first cluster before any data
+  return sync();
+
+ fail:
+  return false;
+}
+// preallocate the next group of clusters
+bool SDfile::logExtend() {
+  uint32_t cluster = logCluster_;
+
+  // aligned if possible
+  if (!vol_->allocContiguous(logExtent_, &cluster, true)
+    && !vol_->allocContiguous(logExtent_, &cluster)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (firstCluster_ == 0) {
+    firstCluster_ = cluster;
+    flags_ |= F_FILE_DIR_DIRTY;
+  }
+  logCluster_ = cluster + logExtent_ - 1;
+  logBlock_ = vol_->clusterStartBlock(cluster);
+  logLeft_ = logExtent_ << vol_->clusterSizeShift_;
+  return true;
+
+ fail:
+  return false;
+}
+// write the first nBlocks buffer blocks and move the rest to the front
+bool SDfile::logFlush(uint8_t nBlocks) {
+  uint8_t* src = logBuf_;
+
+  while (nBlocks) {
+    if (logLeft_ == 0 && !logExtend()) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    uint32_t n = logLeft_ < nBlocks ? logLeft_ : nBlocks;
+    if (vol_->auBlocks_) {
+      // don't cross an allocation unit boundary
+      uint32_t au = vol_->auBlocks_ - logBlock_ % vol_->auBlocks_;
+      if (n > au) n = au;
+    }
+    if (!vol_->writeBlocks(logBlock_, src, n)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    src += 512*n;
+    logFill_ -= 512*n;
+    logBlock_ += n;
+    logLeft_ -= n;
+    logUnsynced_ += n;
+    nBlocks -= n;
+  }
+  if (src != logBuf_) memmove(logBuf_, src, logFill_);
+  return true;
+
+ fail:
+  // keep what wasn't written at the front of the buffer for a retry
+  if (src != logBuf_) memmove(logBuf_, src, logFill_);
+  return false;
+}
+// write all buffered data, the last partial block is kept in the buffer
+bool SDfile::logSync() {
+  if (!logFlush(logFill_ >> 9)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (logFill_) {
+    if (logLeft_ == 0 && !logExtend()) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    if (!vol_->writeBlocks(logBlock_, logBuf_, 1)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+  }
+  if (fileSize_ != curPosition_) {
+    fileSize_ = curPosition_;
+    flags_ |= F_FILE_DIR_DIRTY;
+  }
+  logUnsynced_ = 0;
+  return true;
+
+ fail:
+  return false;
+}
+// free preallocated clusters past the end of the file
+bool SDfile::logTrim() {
+  uint32_t cluster;
+  uint32_t next;
+
+  if (fileSize_ == 0) {
+    if (!vol_->freeChain(firstCluster_)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    firstCluster_ = 0;
+    flags_ |= F_FILE_DIR_DIRTY;
+    return true;
+  }
+  // cluster holding the last byte
+  cluster = ((logFill_ ? logBlock_ : logBlock_ - 1) - vol_->dataStartBlock_)
+    >> vol_->clusterSizeShift_;
+  cluster += 2;
+  if (!vol_->fatGet(cluster, &next)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (!vol_->isEOC(next)) {
+    if (!vol_->fatPutEOC(cluster) || !vol_->freeChain(next)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+  }
+  return true;
+
+ fail:
+  return false;
+}
+/** Append data to a log started with logBegin().
+ *
+ * \param[in] buf Data to append.
+ * \param[in] nbyte Number of bytes.
+ *
+ * \return nbyte for success or -1 for an error, writeError is also set.
+ */
+int SDfile::logWrite(const void* buf, size_t nbyte) {
+  const uint8_t* src = reinterpret_cast<const uint8_t*>(buf);
+  size_t toWrite = nbyte;
+
+  if (!logBuf_) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  while (toWrite) {
+    size_t n = 512*logBlocks_ - logFill_;
+    if (n > toWrite) n = toWrite;
+    memcpy(logBuf_ + logFill_, src, n);
+    logFill_ += n;
+    curPosition_ += n;
+    src += n;
+    toWrite -= n;
+    if (logFill_ == 512*logBlocks_) {
+      if (!logFlush(logBlocks_)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      // buffer is empty so sync() only writes the directory entry
+      if (logUnsynced_ >= logSyncBlocks_ && !sync()) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+    }
+  }
+  return nbyte;
+
+ fail:
+  writeError = true;
+  return -1;
+}
+#endif  // USE_LOG_MODE
+//------------------------------------------------------------------------------
+// format 8.3 name from directory entry, lower case if the NT flags say so
+void SDfile::dirName(const dir_t* dir, char* name, size_t size) {
+  size_t j = 0;
+  for (uint8_t i = 0; i < 11 && j < size - 1; i++) {
+    uint8_t c = dir->name[i];
+    if (c == ' ') continue;
+    if (i == 8) {
+      name[j++] = '.';
+      if (j == size - 1) break;
+    }
+    if (i == 0 && c == DIR_NAME_0XE5) c = DIR_NAME_DELETED;
+    if (c >= 'A' && c <= 'Z'
+      && (dir->reservedNT & (i < 8 ? DIR_NT_LC_BASE : DIR_NT_LC_EXT))) {
+      c += 'a' - 'A';
+    }
+    name[j++] = c;
+  }
+  name[j] = 0;
+}
+//------------------------------------------------------------------------------
 // format directory name field from a 8.3 name string
 bool SDfile::make83Name(const char* str, uint8_t* name, const char** ptr) {
   uint8_t c;
@@ -146,6 +598,16 @@ bool SDfile::make83Name(const char* str, uint8_t* name, const char** ptr) {
 /** Open a file or directory by name.  */
 bool SDfile::open(SDfile* dirFile, const char* path, uint8_t oflag) {
   uint8_t dname[11];
+  const char* lname;
+  uint8_t lnameLen;
+#if USE_LONG_FILE_NAMES
+  const char* end;
+#endif  // USE_LONG_FILE_NAMES
+#if USE_DENTRY_CACHE
+  uint32_t start;
+  uint32_t hash = 2166136261UL;
+  dentry_t* de;
+#endif  // USE_DENTRY_CACHE
   SDfile dir1, dir2;
   SDfile *parent = dirFile;
   SDfile *sub = &dir1;
@@ -169,34 +631,156 @@ bool SDfile::open(SDfile* dirFile, const char* path, uint8_t oflag) {
       parent = &dir2;
     }
   }
+#if USE_DENTRY_CACHE
+  start = parent->firstCluster_;
+#endif  // USE_DENTRY_CACHE
   while (1) {
+#if USE_LONG_FILE_NAMES
+    lname = path;
+    while (*path != '\0' && *path != '/') path++;
+    if (path == lname || path - lname > LDIR_NAME_MAX) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    lnameLen = path - lname;
+    // dname[0] zero if not a legal 8.3 name, it can't match a used entry
+    if (!make83Name(lname, dname, &end)) dname[0] = 0;
+#else  // USE_LONG_FILE_NAMES
+    lname = path;
     if (!make83Name(path, dname, &path)) {
       DBG_FAIL_MACRO;
       goto fail;
     }
+    lnameLen = path - lname;
+#endif  // USE_LONG_FILE_NAMES
+#if USE_DENTRY_CACHE
+    hash = dentryHash(hash, lname, lnameLen);
+#endif  // USE_DENTRY_CACHE
     while (*path == '/') path++;
     if (!*path) break;
-    if (!sub->open(parent, dname, O_READ)) {
+#if USE_DENTRY_CACHE
+    // a cached directory is checked against its parent and its entry's
+    // name: paths whose parents share a hash share one too
+    de = dentryFind(start, hash);
+    if (!de || !de->isDir || de->parentCluster != parent->firstCluster_
+      || !sub->openDentry(parent->vol_, de, dname, lname, lnameLen, O_READ)) {
+      if (!sub->open(parent, dname, lname, lnameLen, O_READ)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      sub->dentryAdd(start, hash, parent->firstCluster_);
+    }
+#else  // USE_DENTRY_CACHE
+    if (!sub->open(parent, dname, lname, lnameLen, O_READ)) {
       DBG_FAIL_MACRO;
       goto fail;
     }
+#endif  // USE_DENTRY_CACHE
     if (parent != dirFile) parent->close();
     parent = sub;
     sub = parent != &dir1 ? &dir1 : &dir2;
   }
-  return open(parent, dname, oflag);
+#if USE_DENTRY_CACHE
+  // a cached file is checked against its parent and its directory entry,
+  // one block read
+  de = dentryFind(start, hash);
+  if (de && de->parentCluster == parent->firstCluster_
+    && openDentry(parent->vol_, de, dname, lname, lnameLen, oflag)) {
+    return true;
+  }
+  if (!open(parent, dname, lname, lnameLen, oflag)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  dentryAdd(start, hash, parent->firstCluster_);
+  return true;
+#else  // USE_DENTRY_CACHE
+  return open(parent, dname, lname, lnameLen, oflag);
+#endif  // USE_DENTRY_CACHE
 
  fail:
   return false;
 }
-// open with filename in dname
-bool SDfile::open(SDfile* dirFile,
-  const uint8_t dname[11], uint8_t oflag) {
+#if USE_LONG_FILE_NAMES
+//------------------------------------------------------------------------------
+// character i of the part of a long name held in one entry
+static uint16_t lfnChar(const ldir_t* ldir, uint8_t i) {
+  if (i < 5) return ldir->name1[i];
+  if (i < 11) return ldir->name2[i - 5];
+  return ldir->name3[i - 11];
+}
+// checksum of the 8.3 name stored in each long name entry
+static uint8_t lfnChecksum(const uint8_t* name) {
+  uint8_t sum = 0;
+  for (uint8_t i = 0; i < 11; i++) {
+    sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+  }
+  return sum;
+}
+// compare one long name entry with its part of name, ASCII case ignored
+static bool lfnMatch(const ldir_t* ldir, const char* name, uint8_t len) {
+  uint16_t n = ((ldir->ord & LDIR_ORD_MASK) - 1)*LDIR_NAME_DIM;
+  for (uint8_t i = 0; i < LDIR_NAME_DIM; i++, n++) {
+    uint16_t c = lfnChar(ldir, i);
+    // name ends in this entry, the rest is terminator and padding
+    if (n == len) return c == 0;
+    // non-ASCII characters never match
+    if (c > 0X7E) return false;
+    uint8_t b = name[n];
+    if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+    if (b >= 'a' && b <= 'z') b -= 'a' - 'A';
+    if (c != b) return false;
+  }
+  return true;
+}
+#endif  // USE_LONG_FILE_NAMES
+#if USE_DENTRY_CACHE
+//------------------------------------------------------------------------------
+// true if entry index of a directory block is named dname, or lname by the
+// long name entries before it.  A long name that starts in the previous
+// block doesn't match, the caller then searches the directory.
+static bool entryHasName(const dir_t* dir, uint8_t index,
+  const uint8_t dname[11], const char* lname, uint8_t lnameLen) {
+  const dir_t* p = dir + index;
+
+  if (p->name[0] == DIR_NAME_FREE || p->name[0] == DIR_NAME_DELETED
+    || !DIR_IS_FILE_OR_SUBDIR(p)) {
+    return false;
+  }
+  if (!memcmp(dname, p->name, 11)) return true;
+#if USE_LONG_FILE_NAMES
+  uint8_t lfnCount = (lnameLen + LDIR_NAME_DIM - 1)/LDIR_NAME_DIM;
+  uint8_t sum = lfnChecksum(p->name);
+  if (lfnCount > index) return false;
+  for (uint8_t ord = 1; ord <= lfnCount; ord++) {
+    const ldir_t* ldir = reinterpret_cast<const ldir_t*>(p - ord);
+    uint8_t last = ord == lfnCount ? LDIR_ORD_LAST_LONG_ENTRY : 0;
+    if (!DIR_IS_LONG_NAME(p - ord) || ldir->ord != (ord | last)
+      || ldir->chksum != sum || !lfnMatch(ldir, lname, lnameLen)) {
+      return false;
+    }
+  }
+  return true;
+#else  // USE_LONG_FILE_NAMES
+  return false;
+#endif  // USE_LONG_FILE_NAMES
+}
+#endif  // USE_DENTRY_CACHE
+//------------------------------------------------------------------------------
+// open with filename in dname or long name lname
+bool SDfile::open(SDfile* dirFile, const uint8_t dname[11],
+  const char* lname, uint8_t lnameLen, uint8_t oflag) {
   cache_t* pc;
   bool emptyFound = false;
   bool fileFound = false;
   uint8_t index;
   dir_t* p;
+#if USE_LONG_FILE_NAMES
+  // entries a long name of lnameLen characters needs, the length gate
+  uint8_t lfnCount = (lnameLen + LDIR_NAME_DIM - 1)/LDIR_NAME_DIM;
+  uint8_t lfnOrd = 0;  // sequence number of last matching entry, 0 if none
+  uint8_t lfnSum = 0;  // checksum from first entry of the matching set
+#endif  // USE_LONG_FILE_NAMES
 
   vol_ = dirFile->vol_;
 
@@ -207,6 +791,8 @@ bool SDfile::open(SDfile* dirFile,
     index = 0XF & (dirFile->curPosition_ >> 5);
     p = dirFile->readDirCache();
     if (!p) {
+      // read() found the end of the cluster chain
+      if (dirFile->curPosition_ == dirFile->fileSize_) break;
       DBG_FAIL_MACRO;
       goto fail;
     }
@@ -219,10 +805,34 @@ bool SDfile::open(SDfile* dirFile,
       }
       // done if no entries follow
       if (p->name[0] == DIR_NAME_FREE) break;
+#if USE_LONG_FILE_NAMES
+      lfnOrd = 0;
+    } else if (DIR_IS_LONG_NAME(p)) {
+      // characters are only compared for a set with the right entry count
+      // and a consistent checksum
+      ldir_t* ldir = reinterpret_cast<ldir_t*>(p);
+      uint8_t ord = ldir->ord & LDIR_ORD_MASK;
+      if (ldir->ord & LDIR_ORD_LAST_LONG_ENTRY) {
+        lfnSum = ldir->chksum;
+        lfnOrd = ord == lfnCount && lfnMatch(ldir, lname, lnameLen) ? ord : 0;
+      } else if (lfnOrd && ord == lfnOrd - 1 && ldir->chksum == lfnSum) {
+        lfnOrd = lfnMatch(ldir, lname, lnameLen) ? ord : 0;
+      } else {
+        lfnOrd = 0;
+      }
+    } else if (!memcmp(dname, p->name, 11)
+      || (lfnOrd == 1 && lfnSum == lfnChecksum(p->name))) {
+      fileFound = true;
+      break;
+    } else {
+      lfnOrd = 0;
+    }
+#else  // USE_LONG_FILE_NAMES
     } else if (!memcmp(dname, p->name, 11)) {
       fileFound = true;
       break;
     }
+#endif  // USE_LONG_FILE_NAMES
   }
   if (fileFound) {
     // don't open existing file if O_EXCL
@@ -231,11 +841,15 @@ bool SDfile::open(SDfile* dirFile,
       goto fail;
     }
   } else {
-    // don't create unless O_CREAT and O_WRITE
-    if (!(oflag & O_CREAT) || !(oflag & O_WRITE)) {
+    // don't create unless O_CREAT and O_WRITE, long names aren't created
+    if (!(oflag & O_CREAT) || !(oflag & O_WRITE) || dname[0] == 0) {
       DBG_FAIL_MACRO;
       goto fail;
     }
+#if USE_DENTRY_CACHE
+    // the directory is about to change, cached sizes may go stale
+    SDvol::dentryClear();
+#endif  // USE_DENTRY_CACHE
     if (emptyFound) {
       index = dirIndex_;
       p = cacheDirEntry(SDvol::CACHE_FOR_WRITE);
@@ -281,6 +895,94 @@ bool SDfile::open(SDfile* dirFile,
  fail:
   return false;
 }
+/** Open the next file or subdirectory in \a dirFile.  Call
+ *  dirFile->rewind() to start at the first entry.
+ *
+ * \param[in] dirFile An open directory.
+ * \param[in] oflag Open flags, O_EXCL is not allowed.
+ * \param[out] name If not null, the long name is returned here, or the 8.3
+ *  name if the entry has no valid long name.  Non-ASCII characters are
+ *  returned as '?' and the name is truncated to fit.
+ * \param[in] size Size of \a name in bytes.
+ *
+ * \return true for success, false at the end of the directory or on error.
+ */
+bool SDfile::openNext(SDfile* dirFile, uint8_t oflag, char* name, size_t size) {
+  uint8_t index;
+  dir_t* p;
+#if USE_LONG_FILE_NAMES
+  uint8_t lfnOrd = 0;
+  uint8_t lfnSum = 0;
+#endif  // USE_LONG_FILE_NAMES
+
+  if (isOpen() || !dirFile || (oflag & O_EXCL) || (name && !size)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  vol_ = dirFile->vol_;
+
+  while (dirFile->curPosition_ < dirFile->fileSize_) {
+    index = 0XF & (dirFile->curPosition_ >> 5);
+    p = dirFile->readDirCache();
+    if (!p) {
+      // read() found the end of the cluster chain
+      if (dirFile->curPosition_ == dirFile->fileSize_) break;
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    // done if no entries follow
+    if (p->name[0] == DIR_NAME_FREE) break;
+#if USE_LONG_FILE_NAMES
+    if (DIR_IS_LONG_NAME(p) && p->name[0] != DIR_NAME_DELETED) {
+      ldir_t* ldir = reinterpret_cast<ldir_t*>(p);
+      uint8_t ord = ldir->ord & LDIR_ORD_MASK;
+      if (ord == 0) {
+        lfnOrd = 0;
+        continue;
+      }
+      if (ldir->ord & LDIR_ORD_LAST_LONG_ENTRY) {
+        lfnSum = ldir->chksum;
+        // terminate here in case the name fills the last entry
+        if (name) {
+          size_t n = ord*LDIR_NAME_DIM;
+          name[n < size ? n : size - 1] = 0;
+        }
+      } else if (!lfnOrd || ord != lfnOrd - 1 || ldir->chksum != lfnSum) {
+        lfnOrd = 0;
+        continue;
+      }
+      lfnOrd = ord;
+      if (!name) continue;
+      size_t n = (ord - 1)*LDIR_NAME_DIM;
+      for (uint8_t i = 0; i < LDIR_NAME_DIM && n < size - 1; i++, n++) {
+        uint16_t c = lfnChar(ldir, i);
+        name[n] = c == 0XFFFF ? 0 : c > 0X7E ? '?' : c;
+      }
+      continue;
+    }
+#endif  // USE_LONG_FILE_NAMES
+    // skip deleted entries, '.', '..' and volume labels
+    if (p->name[0] == DIR_NAME_DELETED
+      || p->name[0] == '.' || !DIR_IS_FILE_OR_SUBDIR(p)) {
+#if USE_LONG_FILE_NAMES
+      lfnOrd = 0;
+#endif  // USE_LONG_FILE_NAMES
+      continue;
+    }
+#if USE_LONG_FILE_NAMES
+    if (name && (lfnOrd != 1 || lfnSum != lfnChecksum(p->name))) {
+      dirName(p, name, size);
+    }
+#else  // USE_LONG_FILE_NAMES
+    if (name) dirName(p, name, size);
+#endif  // USE_LONG_FILE_NAMES
+    return openCachedEntry(index, oflag);
+  }
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
 /** Open a file by index.  */
 bool SDfile::open(SDfile* dirFile, uint16_t index, uint8_t oflag) {
   dir_t* p;
@@ -321,6 +1023,40 @@ bool SDfile::open(SDfile* dirFile, uint16_t index, uint8_t oflag) {
  fail:
   return false;
 }
+/** Reopen a file saved with getHandle().  The directory entry is read
+ *  and checked against the handle, no directory search is done.
+ */
+bool SDfile::open(SDvol* vol, const SDhandle* handle, uint8_t oflag) {
+  cache_t* pc;
+  dir_t* p;
+  uint32_t cluster;
+
+  // error if already open or handle is for another volume
+  if (isOpen() || handle->volSig != vol->signature()
+    || handle->dirIndex > 0XF) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  pc = vol->cacheFetch(handle->dirBlock, SDvol::CACHE_FOR_READ);
+  if (!pc) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  p = pc->dir + handle->dirIndex;
+  cluster = (uint32_t)p->firstClusterHigh << 16 | p->firstClusterLow;
+  // entry must still describe the same file
+  if (p->name[0] == DIR_NAME_FREE || p->name[0] == DIR_NAME_DELETED
+    || !DIR_IS_FILE_OR_SUBDIR(p) || cluster != handle->firstCluster
+    || (DIR_IS_FILE(p) && p->fileSize != handle->fileSize)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  vol_ = vol;
+  return openCachedEntry(handle->dirIndex, oflag);
+
+ fail:
+  return false;
+}
 // open a cached directory entry. Assumes vol_ is initialized
 bool SDfile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   // location of entry in cache
@@ -346,10 +1082,8 @@ bool SDfile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
     fileSize_ = p->fileSize;
     type_ = FAT_FILE_TYPE_NORMAL;
   } else if (DIR_IS_SUBDIR(p)) {
-    if (!setDirSize()) {
-      DBG_FAIL_MACRO;
-      goto fail;
-    }
+    // size found by read() at the end of the chain
+    fileSize_ = DIR_SIZE_MAX;
     type_ = FAT_FILE_TYPE_SUBDIR;
   } else {
     DBG_FAIL_MACRO;
@@ -361,6 +1095,12 @@ bool SDfile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
+#if USE_READ_AHEAD
+  raBuf_ = 0;
+#endif  // USE_READ_AHEAD
+#if USE_LOG_MODE
+  logBuf_ = 0;
+#endif  // USE_LOG_MODE
 
   return oflag & O_AT_END ? seekEnd(0) : true;
 
@@ -383,10 +1123,7 @@ bool SDfile::openRoot(SDvol* vol) {
   } else if (vol->fatType() == 32) {
     type_ = FAT_FILE_TYPE_ROOT32;
     firstCluster_ = vol->rootDirStart();
-    if (!setDirSize()) {
-      DBG_FAIL_MACRO;
-      goto fail;
-    }
+    fileSize_ = DIR_SIZE_MAX;
   } else {
     // volume is not initialized, invalid, or FAT12 without support
     DBG_FAIL_MACRO;
@@ -398,6 +1135,12 @@ bool SDfile::openRoot(SDvol* vol) {
   // set to start of file
   curCluster_ = 0;
   curPosition_ = 0;
+#if USE_READ_AHEAD
+  raBuf_ = 0;
+#endif  // USE_READ_AHEAD
+#if USE_LOG_MODE
+  logBuf_ = 0;
+#endif  // USE_LOG_MODE
 
   // root has no directory entry
   dirBlock_ = 0;
@@ -408,6 +1151,75 @@ bool SDfile::openRoot(SDvol* vol) {
   return false;
 }
 //------------------------------------------------------------------------------
+#if USE_READ_AHEAD
+/** Read the next block after the current position into the read-ahead
+ * ring if there is room.  Call from idle time.  At most one block is read.
+ *
+ * \return false for an I/O error else true.
+ */
+bool SDfile::poll() {
+  uint32_t block;
+  uint32_t cluster;
+  uint32_t fb;
+  uint8_t mask;
+
+  if (!raBuf_ || !isOpen()) return true;
+  raDrop();
+  fb = raFirst_ + raCount_;
+  // ring full or end of file
+  if (raCount_ > raMask_ || fb >= (fileSize_ + 511) >> 9) return true;
+  mask = vol_->blocksPerCluster() - 1;
+  if (raCount_) {
+    cluster = raCluster_;
+    if ((fb & mask) == 0) {
+      // ring spans at most two clusters so read() can find curCluster_
+      if (raFirstCluster_ != raCluster_) return true;
+      if (!vol_->fatGet(cluster, &cluster)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+    }
+  } else if ((curPosition_ & 0X1FF) == 0 && (fb & mask) == 0) {
+    // start of new cluster
+    cluster = firstCluster_;
+    if (curPosition_ && !vol_->fatGet(curCluster_, &cluster)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+  } else {
+    cluster = curCluster_;
+  }
+  block = vol_->clusterStartBlock(cluster) + (fb & mask);
+  if (!vol_->readBlock(block, raBuf_ + 512*(fb & raMask_))) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  if (raCount_++ == 0) raFirstCluster_ = cluster;
+  raCluster_ = cluster;
+  return true;
+
+ fail:
+  return false;
+}
+// drop read-ahead blocks before the current position
+void SDfile::raDrop() {
+  uint32_t fb = curPosition_ >> 9;
+  if (fb < raFirst_ || fb - raFirst_ >= raCount_) {
+    // all used or seek outside ring
+    raCount_ = 0;
+    raFirst_ = fb;
+    return;
+  }
+  while (raFirst_ < fb) {
+    raFirst_++;
+    raCount_--;
+    if ((raFirst_ & (vol_->blocksPerCluster() - 1)) == 0) {
+      raFirstCluster_ = raCluster_;
+    }
+  }
+}
+#endif  // USE_READ_AHEAD
+//------------------------------------------------------------------------------
 /** Read the next byte from a file.  */
 int16_t SDfile::read() {
   uint8_t b;
@@ -437,6 +1249,10 @@ int SDfile::read(void* buf, size_t nbyte) {
     size_t n;
     offset = curPosition_ & 0X1FF;  // offset in block
     blockOfCluster = vol_->blockOfCluster(curPosition_);
+#if USE_READ_AHEAD
+    // current block is first in ring if it was read ahead
+    if (raBuf_) raDrop();
+#endif  // USE_READ_AHEAD
     if (type_ == FAT_FILE_TYPE_ROOT_FIXED) {
       block = vol_->rootDirStart() + (curPosition_ >> 9);
     } else {
@@ -445,22 +1261,53 @@ int SDfile::read(void* buf, size_t nbyte) {
         if (curPosition_ == 0) {
           // use first cluster in file
           curCluster_ = firstCluster_;
+#if USE_READ_AHEAD
+        } else if (raBuf_ && raCount_) {
+          // poll() followed the chain
+          curCluster_ = raFirstCluster_;
+#endif  // USE_READ_AHEAD
         } else {
           // get next cluster from FAT
-          if (!vol_->fatGet(curCluster_, &curCluster_)) {
+          uint32_t next;
+          if (!vol_->fatGet(curCluster_, &next)) {
             DBG_FAIL_MACRO;
             goto fail;
           }
+          if (vol_->isEOC(next)) {
+            // only a directory may end before fileSize_
+            if (!isDir()) {
+              DBG_FAIL_MACRO;
+              goto fail;
+            }
+            // keep curCluster_ so addDirCluster() can extend the chain
+            fileSize_ = curPosition_;
+            nbyte -= toRead;
+            break;
+          }
+          curCluster_ = next;
         }
       }
       block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
     }
+#if USE_READ_AHEAD
+    if (raBuf_ && raCount_) {
+      // copy from read-ahead ring
+      n = 512 - offset;
+      if (n > toRead) n = toRead;
+      memcpy(dst, raBuf_ + 512*(raFirst_ & raMask_) + offset, n);
+    } else
+#endif  // USE_READ_AHEAD
     if (offset != 0 || toRead < 512 || block == vol_->cacheBlockNumber()) {
       // amount to be read from current block
       n = 512 - offset;
       if (n > toRead) n = toRead;
       // read block to cache and copy data to caller
-      pc = vol_->cacheFetch(block, SDvol::CACHE_FOR_READ);
+      if (flags_ & F_FILE_STREAM) {
+        pc = vol_->cacheFetchStream(block);
+      } else {
+        pc = vol_->cacheFetch(block, isDir() ? SDvol::CACHE_FOR_READ
+          : SDvol::CACHE_FOR_READ | SDvol::CACHE_OPTION_DATA);
+      }
       if (!pc) {
         DBG_FAIL_MACRO;
         goto fail;
@@ -489,22 +1336,142 @@ int SDfile::read(void* buf, size_t nbyte) {
           goto fail;
         }
       }
-      if (!vol_->sdCard()->readStart(block)) {
+      if (!vol_->readBlocks(block, dst, nb)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+    }
+    dst += n;
+    curPosition_ += n;
+    toRead -= n;
+  }
+  return nbyte;
+
+ fail:
+  return -1;
+}
+//------------------------------------------------------------------------------
+/** Read data from a file into a list of buffers starting at the current
+ *  position.  The buffers are filled in order as if by one read() per
+ *  buffer, but contiguous blocks are read with one SDdev::readRun()
+ *  whatever the buffer boundaries are.  Whole blocks are read in place,
+ *  a block split between buffers is read once into the cache and copied.
+ *
+ * \param[in] iov Array of buffers.
+ * \param[in] iovcnt Number of elements in \a iov.
+ *
+ * \return The number of bytes read, less than the total of the buffer
+ *  lengths at end of file, or -1 for an error.
+ */
+int SDfile::readv(const SDiovec* iov, uint8_t iovcnt) {
+  cache_t* pc;
+  readv_t rv;
+  size_t n;
+  size_t nbyte = 0;
+  size_t toRead;
+  uint32_t count;
+  uint32_t need;
+  uint32_t next = 0;
+  uint8_t blockOfCluster;
+  uint8_t i;
+  uint8_t* buf;
+
+  // directories are read with read()
+  if (type_ != FAT_FILE_TYPE_NORMAL || !(flags_ & O_READ)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+#if USE_READ_AHEAD
+  if (raBuf_) {
+    // blocks in the ring are already in memory
+    for (i = 0; i < iovcnt; i++) {
+      int r = read(iov[i].base, iov[i].len);
+      if (r < 0) {
         DBG_FAIL_MACRO;
         goto fail;
       }
-      for (uint8_t b = 0; b < nb; b++) {
-        if (!vol_->sdCard()->readData(dst + b*512)) {
+      nbyte += r;
+      if ((size_t)r != iov[i].len) break;
+    }
+    return nbyte;
+  }
+#endif  // USE_READ_AHEAD
+  for (i = 0; i < iovcnt; i++) nbyte += iov[i].len;
+  // max bytes left in file
+  if (nbyte >= (fileSize_ - curPosition_)) {
+    nbyte = fileSize_ - curPosition_;
+  }
+  // the cache may be claimed while a run is open, write it back now
+  if (!vol_->cacheSync()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  rv.iov = iov;
+  rv.end = iov + iovcnt;
+  rv.done = 0;
+  rv.stream = flags_ & F_FILE_STREAM;
+  readvCopy(&rv, 0, 0);
+  toRead = nbyte;
+  while (toRead > 0) {
+    rv.offset = curPosition_ & 0X1FF;
+    blockOfCluster = vol_->blockOfCluster(curPosition_);
+    if (rv.offset == 0 && blockOfCluster == 0) {
+      // start of new cluster, next may be known from the last run
+      if (curPosition_ == 0) {
+        next = firstCluster_;
+      } else if (!next && !vol_->fatGet(curCluster_, &next)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      if (vol_->isEOC(next)) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      curCluster_ = next;
+    }
+    next = 0;
+    rv.block = vol_->clusterStartBlock(curCluster_) + blockOfCluster;
+    if (rv.block == vol_->cacheBlockNumber()
+#if USE_STREAM_CACHE
+      || rv.block == SDvol::cacheStreamBlockNumber_
+#endif  // USE_STREAM_CACHE
+      ) {
+      // copy a cached block with no I/O
+      n = 512 - rv.offset;
+      if (n > toRead) n = toRead;
+      if (!(pc = vol_->cacheFetchStream(rv.block))) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      readvCopy(&rv, pc->data + rv.offset, n);
+    } else {
+      // run to the end of the cluster, extended while the chain is contiguous
+      need = (rv.offset + toRead + 511) >> 9;
+      count = vol_->blocksPerCluster() - blockOfCluster;
+      while (count < need) {
+        if (!vol_->fatGet(curCluster_, &next)) {
           DBG_FAIL_MACRO;
           goto fail;
         }
+        if (next != curCluster_ + 1) break;
+        curCluster_ = next;
+        next = 0;
+        count += vol_->blocksPerCluster();
       }
-      if (!vol_->sdCard()->readStop()) {
+      if (count > need) count = need;
+      n = 512*count - rv.offset;
+      if (n > toRead) n = toRead;
+      rv.left = n;
+      rv.bounce = 0;
+      rv.bounced = 0XFFFFFFFF;
+      buf = readvBuf(&rv);
+      if (!buf || !vol_->readRun(rv.block, count, buf, readvNext, &rv)
+        || rv.left) {
         DBG_FAIL_MACRO;
         goto fail;
       }
+      if (rv.bounce) SDvol::cacheClaimed(rv.stream, rv.bounced);
     }
-    dst += n;
     curPosition_ += n;
     toRead -= n;
   }
@@ -513,6 +1480,53 @@ int SDfile::read(void* buf, size_t nbyte) {
  fail:
   return -1;
 }
+// buffer for the next block of a readv() run
+uint8_t* SDfile::readvBuf(readv_t* rv) {
+  if (rv->offset == 0 && rv->left >= 512 && rv->iov->len - rv->done >= 512) {
+    // whole block in one buffer
+    return reinterpret_cast<uint8_t*>(rv->iov->base) + rv->done;
+  }
+  if (!rv->bounce) {
+    cache_t* pc = SDvol::cacheClaim(rv->stream);
+    if (pc) rv->bounce = pc->data;
+  }
+  return rv->bounce;
+}
+// copy n bytes from src, or skip n bytes read in place if src is null
+void SDfile::readvCopy(readv_t* rv, const uint8_t* src, size_t n) {
+  while (1) {
+    // skip full and empty buffers
+    while (rv->iov < rv->end && rv->done == rv->iov->len) {
+      rv->iov++;
+      rv->done = 0;
+    }
+    if (n == 0) break;
+    size_t m = rv->iov->len - rv->done;
+    if (m > n) m = n;
+    if (src) {
+      memcpy(reinterpret_cast<uint8_t*>(rv->iov->base) + rv->done, src, m);
+      src += m;
+    }
+    rv->done += m;
+    n -= m;
+  }
+}
+// SDdev::readRun() callback for readv()
+uint8_t* SDfile::readvNext(uint8_t* buf, void* context) {
+  readv_t* rv = reinterpret_cast<readv_t*>(context);
+  size_t n = 512 - rv->offset;
+  if (n > rv->left) n = rv->left;
+  if (buf == rv->bounce) {
+    readvCopy(rv, buf + rv->offset, n);
+    rv->bounced = rv->block;
+  } else {
+    readvCopy(rv, 0, n);
+  }
+  rv->block++;
+  rv->left -= n;
+  rv->offset = 0;
+  return rv->left ? readvBuf(rv) : 0;
+}
 // Read next directory entry into the cache
 // Assumes file is correctly positioned
 dir_t* SDfile::readDirCache() {
@@ -544,6 +1558,12 @@ dir_t* SDfile::readDirCache() {
 SDfile::SDfile(const char* path, uint8_t oflag) {
   type_ = FAT_FILE_TYPE_CLOSED;
   writeError = false;
+#if USE_READ_AHEAD
+  raBuf_ = 0;
+#endif  // USE_READ_AHEAD
+#if USE_LOG_MODE
+  logBuf_ = 0;
+#endif  // USE_LOG_MODE
   open(path, oflag);
 }
 //------------------------------------------------------------------------------
@@ -578,7 +1598,8 @@ bool SDfile::seekSet(uint32_t pos) {
     nNew -= nCur;
   }
   while (nNew--) {
-    if (!vol_->fatGet(curCluster_, &curCluster_)) {
+    if (!vol_->fatGet(curCluster_, &curCluster_)
+      || vol_->isEOC(curCluster_)) {
       DBG_FAIL_MACRO;
       goto fail;
     }
@@ -592,28 +1613,27 @@ bool SDfile::seekSet(uint32_t pos) {
   return false;
 }
 //------------------------------------------------------------------------------
-// set fileSize_ for a directory
-bool SDfile::setDirSize() {
-  uint16_t s = 0;
-  uint32_t cluster = firstCluster_;
-  do {
-    if (!vol_->fatGet(cluster, &cluster)) {
-      DBG_FAIL_MACRO;
-      goto fail;
-    }
-    s += vol_->blocksPerCluster();
-    // max size if a directory file is 4096 blocks
-    if (s >= 4096) {
-      DBG_FAIL_MACRO;
-      goto fail;
-    }
-  } while (!vol_->isEOC(cluster));
-  fileSize_ = 512L*s;
+#if USE_READ_AHEAD
+/** Read ahead of the file position into \a buf, a ring of \a nBlocks
+ *  512 byte blocks.  \a nBlocks must be a power of two.  Blocks are read
+ *  by poll() so read() finds them in RAM.  A null \a buf turns read-ahead
+ *  off.  Cleared by open().
+ */
+bool SDfile::setReadAhead(uint8_t* buf, uint8_t nBlocks) {
+  if (buf && (!isOpen() || isDir() || !nBlocks || (nBlocks & (nBlocks - 1)))) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  raBuf_ = buf;
+  raMask_ = nBlocks - 1;
+  raCount_ = 0;
+  raFirst_ = curPosition_ >> 9;
   return true;
 
  fail:
   return false;
 }
+#endif  // USE_READ_AHEAD
 //------------------------------------------------------------------------------
 /** The sync() call causes all modified data and directory fields
  * to be written to the storage device.
@@ -624,6 +1644,12 @@ bool SDfile::sync() {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if USE_LOG_MODE
+  if (logBuf_ && !logSync()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+#endif  // USE_LOG_MODE
   if (flags_ & F_FILE_DIR_DIRTY) {
     dir_t* d = cacheDirEntry(SDvol::CACHE_FOR_WRITE);
     // check for deleted by another open file object
@@ -641,7 +1667,7 @@ bool SDfile::sync() {
     // clear directory dirty
     flags_ &= ~F_FILE_DIR_DIRTY;
   }
-  return vol_->cacheSync();
+  return vol_->cacheSync() && vol_->device()->sync();
 
  fail:
   writeError = true;
@@ -122,6 +122,48 @@ uint16_t const FAT_DEFAULT_DATE = ((2000 - 1980) << 9) | (1 << 5) | 1;
 /** Default time for file timestamp is 1 am */
 uint16_t const FAT_DEFAULT_TIME = (1 << 11);
 //------------------------------------------------------------------------------
+/**
+ * \struct SDextent
+ * \brief Run of contiguous device blocks holding part of a file.
+ */
+struct SDextent {
+           /** First device block of the run. */
+  uint32_t block;
+           /** Number of blocks in the run. */
+  uint32_t count;
+};
+//------------------------------------------------------------------------------
+/**
+ * \struct SDiovec
+ * \brief Caller buffer for SDfile::readv().
+ */
+struct SDiovec {
+           /** Start of the buffer. */
+  void*    base;
+           /** Number of bytes to read into the buffer. */
+  size_t   len;
+};
+//------------------------------------------------------------------------------
+/**
+ * \struct SDhandle
+ * \brief Location of a file's directory entry.
+ *
+ * May be saved in EEPROM or a file and passed to SDfile::open() on a
+ * later boot to reopen the file without a directory search.
+ */
+struct SDhandle {
+           /** SDvol::signature() of the volume holding the file. */
+  uint32_t volSig;
+           /** Block holding the file's directory entry. */
+  uint32_t dirBlock;
+           /** First cluster of the file. */
+  uint32_t firstCluster;
+           /** File size in bytes. */
+  uint32_t fileSize;
+           /** Index of the directory entry in dirBlock. */
+  uint8_t  dirIndex;
+}__attribute__((packed));
+//------------------------------------------------------------------------------
 /**
  * \class SDfile
  * \brief Base class for SdFile with Print and C++ streams.
@@ -129,7 +171,14 @@ uint16_t const FAT_DEFAULT_TIME = (1 << 11);
 class SDfile {
  public:
   /** Create an instance. */
-  SDfile() : writeError(false), type_(FAT_FILE_TYPE_CLOSED) {}
+  SDfile() : writeError(false), type_(FAT_FILE_TYPE_CLOSED) {
+#if USE_READ_AHEAD
+    raBuf_ = 0;
+#endif  // USE_READ_AHEAD
+#if USE_LOG_MODE
+    logBuf_ = 0;
+#endif  // USE_LOG_MODE
+  }
   SDfile(const char* path, uint8_t oflag);
   /**
    * writeError is set to true if an error occurs during a write().
@@ -139,6 +188,8 @@ class SDfile {
   bool writeError;
   //----------------------------------------------------------------------------
   bool close();
+  int extents(SDextent* ext, uint8_t maxExtents, uint32_t startBlock = 0);
+  bool getHandle(SDhandle* handle) const;
   /** \return True if this is a directory else false. */
   bool isDir() const {return type_ >= FAT_FILE_TYPE_MIN_DIR;}
   /** \return True if this is an open file/directory else false. */
@@ -147,16 +198,37 @@ class SDfile {
   bool isRoot() const {
     return type_ == FAT_FILE_TYPE_ROOT_FIXED || type_ == FAT_FILE_TYPE_ROOT32;
   }
+#if USE_LOG_MODE
+  bool logBegin(uint8_t* buf, uint8_t nBlocks, uint32_t prealloc,
+    uint16_t syncBlocks);
+  int logWrite(const void* buf, size_t nbyte);
+#endif  // USE_LOG_MODE
   bool open(SDfile* dirFile, uint16_t index, uint8_t oflag);
   bool open(SDfile* dirFile, const char* path, uint8_t oflag);
   bool open(const char* path, uint8_t oflag = O_READ);
+  bool open(SDvol* vol, const SDhandle* handle, uint8_t oflag = O_READ);
+  bool openNext(SDfile* dirFile, uint8_t oflag = O_READ,
+    char* name = 0, size_t size = 0);
   bool openRoot(SDvol* vol);
+#if USE_READ_AHEAD
+  bool poll();
+#endif  // USE_READ_AHEAD
   int16_t read();
   int read(void* buf, size_t nbyte);
+  int readv(const SDiovec* iov, uint8_t iovcnt);
   /** Set the file's current position to zero. */
   void rewind() {seekSet(0);}
   bool seekSet(uint32_t pos);
   bool seekEnd(int32_t offset = 0) {return seekSet(fileSize_ + offset);}
+  /** Stream hint.  Partial block reads use a separate cache block so
+   * streamed data doesn't evict directory and FAT blocks.  Cleared by open().
+   */
+  void setStream(bool on) {
+    if (on) flags_ |= F_FILE_STREAM; else flags_ &= ~F_FILE_STREAM;
+  }
+#if USE_READ_AHEAD
+  bool setReadAhead(uint8_t* buf, uint8_t nBlocks);
+#endif  // USE_READ_AHEAD
   bool sync();
 //------------------------------------------------------------------------------
  private:
@@ -167,8 +239,13 @@ class SDfile {
   // bits defined in flags_
   // should be 0X0F
   static uint8_t const F_OFLAG = (O_ACCMODE | O_APPEND | O_SYNC);
+  // read partial blocks with SDvol::cacheFetchStream()
+  static uint8_t const F_FILE_STREAM = 0X40;
   // sync of directory entry required
   static uint8_t const F_FILE_DIR_DIRTY = 0X80;
+  // directory size limit, fileSize_ of a directory until read() finds the
+  // end of the chain
+  static uint32_t const DIR_SIZE_MAX = 512UL*4096;
 
   // private data
   uint8_t   flags_;         // See above for definition of flags_ bits
@@ -181,16 +258,67 @@ class SDfile {
   uint32_t  dirBlock_;      // block for this files directory entry
   uint32_t  fileSize_;      // file size in bytes
   uint32_t  firstCluster_;  // first cluster of file
+#if USE_READ_AHEAD
+  uint8_t*  raBuf_;          // read-ahead ring or null
+  uint8_t   raMask_;         // ring size in blocks minus one
+  uint8_t   raCount_;        // blocks in ring
+  uint32_t  raFirst_;        // file block index of oldest block in ring
+  uint32_t  raFirstCluster_;  // cluster of oldest block in ring
+  uint32_t  raCluster_;      // cluster of newest block in ring
+#endif  // USE_READ_AHEAD
+#if USE_LOG_MODE
+  uint8_t*  logBuf_;         // log block buffer or null
+  uint8_t   logBlocks_;      // buffer size in blocks
+  uint16_t  logFill_;        // bytes in buffer
+  uint16_t  logSyncBlocks_;  // blocks written between size updates
+  uint16_t  logUnsynced_;    // blocks written since the last size update
+  uint32_t  logBlock_;       // device block for the start of the buffer
+  uint32_t  logLeft_;        // preallocated blocks from logBlock_
+  uint32_t  logCluster_;     // last preallocated cluster
+  uint32_t  logExtent_;      // clusters per preallocation
+#endif  // USE_LOG_MODE
 
   // private functions
   bool addCluster();
   cache_t* addDirCluster();
   dir_t* cacheDirEntry(uint8_t action);
+#if USE_DENTRY_CACHE
+  void dentryAdd(uint32_t start, uint32_t hash, uint32_t parent) const;
+  static dentry_t* dentryFind(uint32_t start, uint32_t hash);
+  static uint32_t dentryHash(uint32_t hash, const char* name, uint8_t len);
+  bool openDentry(SDvol* vol, const dentry_t* de, const uint8_t dname[11],
+    const char* lname, uint8_t lnameLen, uint8_t oflag);
+#endif  // USE_DENTRY_CACHE
+  static void dirName(const dir_t* dir, char* name, size_t size);
+#if USE_LOG_MODE
+  bool logExtend();
+  bool logFlush(uint8_t nBlocks);
+  bool logSync();
+  bool logTrim();
+#endif  // USE_LOG_MODE
   static bool make83Name(const char* str, uint8_t* name, const char** ptr);
-  bool open(SDfile* dirFile, const uint8_t dname[11], uint8_t oflag);
+  bool open(SDfile* dirFile, const uint8_t dname[11],
+    const char* lname, uint8_t lnameLen, uint8_t oflag);
   bool openCachedEntry(uint8_t cacheIndex, uint8_t oflags);
+#if USE_READ_AHEAD
+  void raDrop();
+#endif  // USE_READ_AHEAD
   dir_t* readDirCache();
-  bool setDirSize();
+  // position in a readv() buffer list, context for readvNext()
+  struct readv_t {
+    const SDiovec* iov;  // current buffer
+    const SDiovec* end;  // end of list
+    size_t done;         // bytes filled in *iov
+    size_t left;         // bytes left in the current run
+    uint8_t* bounce;     // cache buffer for blocks not read in place
+    uint32_t block;      // device block for the next callback
+    uint32_t bounced;    // last block read into bounce
+    uint16_t offset;     // offset of wanted data in the next block
+    bool stream;         // bounce through the stream cache
+  };
+  static uint8_t* readvBuf(readv_t* rv);
+  static void readvCopy(readv_t* rv, const uint8_t* src, size_t n);
+  static uint8_t* readvNext(uint8_t* buf, void* context);
 };
 
 #endif  // SDlite-file_h
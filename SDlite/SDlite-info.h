@@ -50,6 +50,8 @@ uint8_t const CMD55 = 0X37;
 uint8_t const CMD58 = 0X3A;
 /** CRC_ON_OFF - enable or disable CRC checking */
 uint8_t const CMD59 = 0X3B;
+/** SD_STATUS - read the 64 byte SD Status register */
+uint8_t const ACMD13 = 0X0D;
 /** SET_WR_BLK_ERASE_COUNT - Set the number of write blocks to be
      pre-erased before writing */
 uint8_t const ACMD23 = 0X17;
@@ -560,6 +562,48 @@ uint8_t const DIR_ATT_DEFINED_BITS = 0X3F;
 static inline uint8_t DIR_IS_LONG_NAME(const dir_t* dir) {
   return (dir->attributes & DIR_ATT_LONG_NAME_MASK) == DIR_ATT_LONG_NAME;
 }
+//------------------------------------------------------------------------------
+/**
+ * \struct longDirectoryEntry
+ * \brief VFAT long name directory entry.
+ *
+ * A long name is stored in up to 20 entries placed in reverse order just
+ * before its short 8.3 entry.  Each holds 13 UTF-16 characters.
+ */
+struct longDirectoryEntry {
+          /** Sequence number 1-20.  LDIR_ORD_LAST_LONG_ENTRY is set in the
+           *  first entry of a set, which holds the end of the name.
+           */
+  uint8_t  ord;
+           /** Characters 1-5 of this part of the name. */
+  uint16_t name1[5];
+           /** Always DIR_ATT_LONG_NAME. */
+  uint8_t  attr;
+           /** Zero for a name entry. */
+  uint8_t  type;
+           /** Checksum of the 8.3 name in the short entry. */
+  uint8_t  chksum;
+           /** Characters 6-11 of this part of the name. */
+  uint16_t name2[6];
+           /** Must be zero. */
+  uint16_t mustBeZero;
+           /** Characters 12-13 of this part of the name. */
+  uint16_t name3[2];
+}__attribute__((packed));
+/** Type name for longDirectoryEntry */
+typedef struct longDirectoryEntry ldir_t;
+/** Mask for the sequence number in ord */
+uint8_t const LDIR_ORD_MASK = 0X1F;
+/** ord flag for the entry holding the end of the name */
+uint8_t const LDIR_ORD_LAST_LONG_ENTRY = 0X40;
+/** Characters in each long name entry */
+uint8_t const LDIR_NAME_DIM = 13;
+/** Maximum long name length */
+uint8_t const LDIR_NAME_MAX = 255;
+/** reservedNT flag - 8.3 base name is displayed in lower case */
+uint8_t const DIR_NT_LC_BASE = 0X08;
+/** reservedNT flag - 8.3 extension is displayed in lower case */
+uint8_t const DIR_NT_LC_EXT = 0X10;
 /** Mask for file/subdirectory tests */
 uint8_t const DIR_ATT_FILE_TYPE_MASK = (DIR_ATT_VOLUME_ID | DIR_ATT_DIRECTORY);
 /** Directory entry is for a file */
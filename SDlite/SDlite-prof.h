@@ -0,0 +1,32 @@
+/* Stripped-down version of Arduino SD Library
+ * James Lyden <james@lyden.org>
+ */
+
+#ifndef SDliteprof_h
+#define SDliteprof_h
+#include <SDlite-config.h>
+//------------------------------------------------------------------------------
+// startup stages, see SD::stageMicros()
+/** SDspi::init() entered */
+uint8_t const SD_STAGE_START = 0;
+/** card answered CMD0 with idle state */
+uint8_t const SD_STAGE_CMD0 = 1;
+/** CMD8 and ACMD41 loop done - card ready */
+uint8_t const SD_STAGE_ACMD41 = 2;
+/** master boot record read */
+uint8_t const SD_STAGE_MBR = 3;
+/** FAT boot sector read */
+uint8_t const SD_STAGE_BOOT = 4;
+/** root directory open */
+uint8_t const SD_STAGE_ROOT = 5;
+/** number of stage timestamps */
+uint8_t const SD_STAGE_COUNT = 6;
+//------------------------------------------------------------------------------
+#if USE_SD_PROFILE
+#include <Arduino.h>
+extern uint32_t sdStageStamp[SD_STAGE_COUNT];
+#define SD_PROFILE(stage) sdStageStamp[stage] = micros()
+#else  // USE_SD_PROFILE
+#define SD_PROFILE(stage)
+#endif  // USE_SD_PROFILE
+#endif  // SDliteprof_h
@@ -0,0 +1,45 @@
+/* Stripped-down version of Arduino SD Library
+ * James Lyden <james@lyden.org>
+ */
+
+#ifndef SDliteram_h
+#define SDliteram_h
+#include <string.h>
+#include <SDlite-dev.h>
+//------------------------------------------------------------------------------
+/**
+ * \class SDram
+ * \brief RAM disk backend for SDvol.
+ *
+ * The caller supplies the storage, normally a FAT image of blockCount
+ * blocks.  Useful for benchmarking the FAT layer at memory speed.
+ */
+class SDram : public SDdev {
+ public:
+  /** Create a RAM disk on \a blockCount blocks at \a data. */
+  SDram(uint8_t* data, uint32_t blockCount)
+    : data_(data), blockCount_(blockCount) {}
+  /** \return The number of blocks on the device. */
+  uint32_t blockCount() const {return blockCount_;}
+  bool readBlock(uint32_t block, uint8_t* dst) {
+    return readBlocks(block, dst, 1);
+  }
+  bool readBlocks(uint32_t block, uint8_t* dst, size_t count) {
+    if (block >= blockCount_ || count > blockCount_ - block) return false;
+    memcpy(dst, data_ + 512UL*block, 512UL*count);
+    return true;
+  }
+  bool writeBlock(uint32_t block, const uint8_t* src) {
+    return writeBlocks(block, src, 1);
+  }
+  bool writeBlocks(uint32_t block, const uint8_t* src, size_t count) {
+    if (block >= blockCount_ || count > blockCount_ - block) return false;
+    memcpy(data_ + 512UL*block, src, 512UL*count);
+    return true;
+  }
+
+ private:
+  uint8_t* data_;
+  uint32_t blockCount_;
+};
+#endif  // SDliteram_h
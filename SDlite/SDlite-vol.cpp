@@ -3,11 +3,12 @@
  */
 
 #include <SDlite-vol.h>
+#include <SDlite-prof.h>
 // macro for debug
 #define DBG_FAIL_MACRO  //  Serial.print(__FILE__);Serial.println(__LINE__)
 //------------------------------------------------------------------------------
 // raw block cache
-cache_t  SDvol::cacheBuffer_;       // 512 byte cache for SDspi
+cache_t  SDvol::cacheBuffer_;       // 512 byte cache for SDdev
 uint32_t SDvol::cacheBlockNumber_;  // current block number
 uint8_t  SDvol::cacheStatus_;       // status of cache block
 uint32_t SDvol::cacheFatOffset_;    // offset for mirrored FAT
@@ -16,10 +17,43 @@ cache_t  SDvol::cacheFatBuffer_;       // 512 byte cache for FAT
 uint32_t SDvol::cacheFatBlockNumber_;  // current Fat block number
 uint8_t  SDvol::cacheFatStatus_;       // status of cache Fatblock
 #endif  // USE_SEPARATE_FAT_CACHE
-SDspi* SDvol::sdCard_;            // pointer to SD card object
+#if USE_STREAM_CACHE
+cache_t  SDvol::cacheStreamBuffer_;        // 512 byte cache for stream data
+uint32_t SDvol::cacheStreamBlockNumber_;  // current stream block number
+#endif  // USE_STREAM_CACHE
+#if USE_FAT_PREFETCH
+cache_t  SDvol::cachePrefetchBuffer_[FAT_PREFETCH_BLOCKS];  // FAT blocks
+uint32_t SDvol::cachePrefetchBlockNumber_;  // first block in buffer
+uint8_t  SDvol::cachePrefetchCount_;        // blocks in buffer
+uint32_t SDvol::fatLastValue_;              // last value from fatGet()
+#endif  // USE_FAT_PREFETCH
+#if USE_CACHE_STATS
+cache_stats_t SDvol::cacheStats_;
+// count a cache lookup or miss by block class
+#define CACHE_COUNT(options, event)\
+  if ((options) & CACHE_OPTION_DATA) cacheStats_.data##event++;\
+  else cacheStats_.meta##event++
+#else  // USE_CACHE_STATS
+#define CACHE_COUNT(options, event)
+#endif  // USE_CACHE_STATS
+#if USE_SD_TRACE
+sd_trace_t SDvol::trace_[SD_TRACE_SIZE];  // ring of trace entries
+sd_trace_index_t SDvol::traceNext_;       // next entry to write
+uint32_t SDvol::traceCount_;              // entries since last emptied
+#endif  // USE_SD_TRACE
+// trace a cache lookup, the options become the event flags
+#define CACHE_TRACE(kind, options, block)\
+  SD_TRACE((kind) | ((options) & 0X0F) << 4, block)
+#if USE_DENTRY_CACHE
+dentry_t SDvol::dentry_[DENTRY_CACHE_SIZE];  // resolved paths
+uint8_t  SDvol::dentryNext_;                 // next entry to replace
+#endif  // USE_DENTRY_CACHE
+SDdev* SDvol::dev_;               // pointer to block device
 //------------------------------------------------------------------------------
-// find a contiguous group of clusters
-bool SDvol::allocContiguous(uint32_t count, uint32_t* curCluster) {
+// find a contiguous group of clusters, starting on an allocation unit
+// boundary if align is true and the unit is at least one cluster
+bool SDvol::allocContiguous(uint32_t count, uint32_t* curCluster,
+  bool align) {
   // start of group
   uint32_t bgnCluster;
   // end of group
@@ -30,6 +64,8 @@ bool SDvol::allocContiguous(uint32_t count, uint32_t* curCluster) {
   // flag to save place to start next search
   bool setStart;
 
+  if (auBlocks_ < blocksPerCluster_) align = false;
+
   // set search start cluster
   if (*curCluster) {
     // try to make file contiguous
@@ -64,8 +100,9 @@ bool SDvol::allocContiguous(uint32_t count, uint32_t* curCluster) {
       goto fail;
     }
 
-    if (f != 0) {
-      // cluster in use try next cluster as bgnCluster
+    if (f != 0 || (align && endCluster == bgnCluster
+      && clusterStartBlock(bgnCluster) % auBlocks_)) {
+      // cluster in use or not aligned try next cluster as bgnCluster
       bgnCluster = endCluster + 1;
     } else if ((endCluster - bgnCluster + 1) == count) {
       // done - found space
@@ -112,19 +149,25 @@ cache_t* SDvol::cacheFetch(uint32_t blockNumber, uint8_t options) {
 }
 //------------------------------------------------------------------------------
 cache_t* SDvol::cacheFetchData(uint32_t blockNumber, uint8_t options) {
+  CACHE_COUNT(options, Lookups);
+  if (options & CACHE_STATUS_DIRTY) cacheInvalidateStream(blockNumber);
   if (cacheBlockNumber_ != blockNumber) {
+    CACHE_COUNT(options, Misses);
+    CACHE_TRACE(SD_TRACE_MISS, options, blockNumber);
     if (!cacheWriteData()) {
       DBG_FAIL_MACRO;
       goto fail;
     }
     if (!(options & CACHE_OPTION_NO_READ)) {
-      if (!sdCard_->readBlock(blockNumber, cacheBuffer_.data)) {
+      if (!dev_->readBlock(blockNumber, cacheBuffer_.data)) {
         DBG_FAIL_MACRO;
         goto fail;
       }
     }
     cacheStatus_ = 0;
     cacheBlockNumber_ = blockNumber;
+  } else {
+    CACHE_TRACE(SD_TRACE_HIT, options, blockNumber);
   }
   cacheStatus_ |= options & CACHE_STATUS_MASK;
   return &cacheBuffer_;
@@ -134,19 +177,24 @@ cache_t* SDvol::cacheFetchData(uint32_t blockNumber, uint8_t options) {
 }
 //------------------------------------------------------------------------------
 cache_t* SDvol::cacheFetchFat(uint32_t blockNumber, uint8_t options) {
+  CACHE_COUNT(options, Lookups);
   if (cacheFatBlockNumber_ != blockNumber) {
+    CACHE_COUNT(options, Misses);
+    CACHE_TRACE(SD_TRACE_MISS, options | CACHE_STATUS_FAT_BLOCK, blockNumber);
     if (!cacheWriteFat()) {
       DBG_FAIL_MACRO;
       goto fail;
     }
     if (!(options & CACHE_OPTION_NO_READ)) {
-      if (!sdCard_->readBlock(blockNumber, cacheFatBuffer_.data)) {
+      if (!dev_->readBlock(blockNumber, cacheFatBuffer_.data)) {
         DBG_FAIL_MACRO;
         goto fail;
       }
     }
     cacheFatStatus_ = 0;
     cacheFatBlockNumber_ = blockNumber;
+  } else {
+    CACHE_TRACE(SD_TRACE_HIT, options | CACHE_STATUS_FAT_BLOCK, blockNumber);
   }
   cacheFatStatus_ |= options & CACHE_STATUS_MASK;
   return &cacheFatBuffer_;
@@ -156,12 +204,14 @@ cache_t* SDvol::cacheFetchFat(uint32_t blockNumber, uint8_t options) {
 }
 //------------------------------------------------------------------------------
 bool SDvol::cacheSync() {
+  SD_TRACE(SD_TRACE_SYNC, 0);
   return cacheWriteData() && cacheWriteFat();
 }
 //------------------------------------------------------------------------------
 bool SDvol::cacheWriteData() {
   if (cacheStatus_ & CACHE_STATUS_DIRTY) {
-    if (!sdCard_->writeBlock(cacheBlockNumber_, cacheBuffer_.data)) {
+    CACHE_TRACE(SD_TRACE_WRITEBACK, cacheStatus_, cacheBlockNumber_);
+    if (!dev_->writeBlock(cacheBlockNumber_, cacheBuffer_.data)) {
       DBG_FAIL_MACRO;
       goto fail;
     }
@@ -175,14 +225,18 @@ bool SDvol::cacheWriteData() {
 //------------------------------------------------------------------------------
 bool SDvol::cacheWriteFat() {
   if (cacheFatStatus_ & CACHE_STATUS_DIRTY) {
-    if (!sdCard_->writeBlock(cacheFatBlockNumber_, cacheFatBuffer_.data)) {
+    CACHE_TRACE(SD_TRACE_WRITEBACK, cacheFatStatus_ | CACHE_STATUS_FAT_BLOCK,
+      cacheFatBlockNumber_);
+    if (!dev_->writeBlock(cacheFatBlockNumber_, cacheFatBuffer_.data)) {
       DBG_FAIL_MACRO;
       goto fail;
     }
     // mirror second FAT
     if (cacheFatOffset_) {
       uint32_t lbn = cacheFatBlockNumber_ + cacheFatOffset_;
-      if (!sdCard_->writeBlock(lbn, cacheFatBuffer_.data)) {
+      CACHE_TRACE(SD_TRACE_WRITEBACK, cacheFatStatus_ | CACHE_STATUS_FAT_BLOCK,
+        lbn);
+      if (!dev_->writeBlock(lbn, cacheFatBuffer_.data)) {
         DBG_FAIL_MACRO;
         goto fail;
       }
@@ -197,19 +251,25 @@ bool SDvol::cacheWriteFat() {
 #else  // USE_SEPARATE_FAT_CACHE
 //------------------------------------------------------------------------------
 cache_t* SDvol::cacheFetch(uint32_t blockNumber, uint8_t options) {
+  CACHE_COUNT(options, Lookups);
+  if (options & CACHE_STATUS_DIRTY) cacheInvalidateStream(blockNumber);
   if (cacheBlockNumber_ != blockNumber) {
-    if (!cacheSync()) {
+    CACHE_COUNT(options, Misses);
+    CACHE_TRACE(SD_TRACE_MISS, options, blockNumber);
+    if (!cacheWriteData()) {
       DBG_FAIL_MACRO;
       goto fail;
     }
     if (!(options & CACHE_OPTION_NO_READ)) {
-      if (!sdCard_->readBlock(blockNumber, cacheBuffer_.data)) {
+      if (!dev_->readBlock(blockNumber, cacheBuffer_.data)) {
         DBG_FAIL_MACRO;
         goto fail;
       }
     }
     cacheStatus_ = 0;
     cacheBlockNumber_ = blockNumber;
+  } else {
+    CACHE_TRACE(SD_TRACE_HIT, options, blockNumber);
   }
   cacheStatus_ |= options & CACHE_STATUS_MASK;
   return &cacheBuffer_;
@@ -223,15 +283,22 @@ cache_t* SDvol::cacheFetchFat(uint32_t blockNumber, uint8_t options) {
 }
 //------------------------------------------------------------------------------
 bool SDvol::cacheSync() {
+  SD_TRACE(SD_TRACE_SYNC, 0);
+  return cacheWriteData();
+}
+//------------------------------------------------------------------------------
+bool SDvol::cacheWriteData() {
   if (cacheStatus_ & CACHE_STATUS_DIRTY) {
-    if (!sdCard_->writeBlock(cacheBlockNumber_, cacheBuffer_.data)) {
+    CACHE_TRACE(SD_TRACE_WRITEBACK, cacheStatus_, cacheBlockNumber_);
+    if (!dev_->writeBlock(cacheBlockNumber_, cacheBuffer_.data)) {
       DBG_FAIL_MACRO;
       goto fail;
     }
     // mirror second FAT
     if ((cacheStatus_ & CACHE_STATUS_FAT_BLOCK) && cacheFatOffset_) {
       uint32_t lbn = cacheBlockNumber_ + cacheFatOffset_;
-      if (!sdCard_->writeBlock(lbn, cacheBuffer_.data)) {
+      CACHE_TRACE(SD_TRACE_WRITEBACK, cacheStatus_, lbn);
+      if (!dev_->writeBlock(lbn, cacheBuffer_.data)) {
         DBG_FAIL_MACRO;
         goto fail;
       }
@@ -243,11 +310,142 @@ bool SDvol::cacheSync() {
  fail:
   return false;
 }
+#endif  // USE_SEPARATE_FAT_CACHE
+#if USE_FAT_PREFETCH
 //------------------------------------------------------------------------------
-bool SDvol::cacheWriteData() {
-  return cacheSync();
-}
+// Fetch a FAT block while following a cluster chain.  On a miss the block
+// and the FAT blocks after it are read with one multiple block read so a
+// fragmented chain costs one command per FAT_PREFETCH_BLOCKS blocks.
+cache_t* SDvol::cacheFetchPrefetch(uint32_t blockNumber) {
+  uint32_t n;
+#if USE_SEPARATE_FAT_CACHE
+  if (cacheFatBlockNumber_ == blockNumber) {
+#else  // USE_SEPARATE_FAT_CACHE
+  if (cacheBlockNumber_ == blockNumber) {
+#endif  // USE_SEPARATE_FAT_CACHE
+    return cacheFetchFat(blockNumber, CACHE_FOR_READ);
+  }
+  CACHE_COUNT(CACHE_FOR_READ, Lookups);
+  n = blockNumber - cachePrefetchBlockNumber_;
+  if (n < cachePrefetchCount_) {
+    SD_TRACE(SD_TRACE_PREFETCH_HIT | SD_TRACE_FAT, blockNumber);
+    return &cachePrefetchBuffer_[n];
+  }
+  CACHE_COUNT(CACHE_FOR_READ, Misses);
+  SD_TRACE(SD_TRACE_PREFETCH_MISS | SD_TRACE_FAT, blockNumber);
+  // a dirty FAT block in the cache must be on the device first
+#if USE_SEPARATE_FAT_CACHE
+  if (!cacheWriteFat()) {
+#else  // USE_SEPARATE_FAT_CACHE
+  if (!cacheWriteData()) {
 #endif  // USE_SEPARATE_FAT_CACHE
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  n = fatStartBlock_ + blocksPerFat_ - blockNumber;
+  if (n > FAT_PREFETCH_BLOCKS) n = FAT_PREFETCH_BLOCKS;
+  cachePrefetchCount_ = 0;
+  if (!dev_->readBlocks(blockNumber, cachePrefetchBuffer_[0].data, n)) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  cachePrefetchBlockNumber_ = blockNumber;
+  cachePrefetchCount_ = n;
+  return &cachePrefetchBuffer_[0];
+
+ fail:
+  return 0;
+}
+#endif  // USE_FAT_PREFETCH
+//------------------------------------------------------------------------------
+// Fetch a data block for a file read with SDfile::setStream().  The main
+// cache is used only if it already holds the block so directory and FAT
+// blocks are not evicted.
+cache_t* SDvol::cacheFetchStream(uint32_t blockNumber) {
+#if USE_STREAM_CACHE
+  CACHE_COUNT(CACHE_OPTION_DATA, Lookups);
+  if (cacheBlockNumber_ == blockNumber) {
+    SD_TRACE(SD_TRACE_STREAM_HIT | SD_TRACE_DATA, blockNumber);
+    return &cacheBuffer_;
+  }
+  if (cacheStreamBlockNumber_ != blockNumber) {
+    CACHE_COUNT(CACHE_OPTION_DATA, Misses);
+    SD_TRACE(SD_TRACE_STREAM_MISS | SD_TRACE_DATA, blockNumber);
+    if (!dev_->readBlock(blockNumber, cacheStreamBuffer_.data)) {
+      cacheStreamBlockNumber_ = 0XFFFFFFFF;
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    cacheStreamBlockNumber_ = blockNumber;
+  } else {
+    SD_TRACE(SD_TRACE_STREAM_HIT | SD_TRACE_DATA, blockNumber);
+  }
+  return &cacheStreamBuffer_;
+
+ fail:
+  return 0;
+#else  // USE_STREAM_CACHE
+  return cacheFetch(blockNumber, CACHE_FOR_READ | CACHE_OPTION_DATA);
+#endif  // USE_STREAM_CACHE
+}
+//------------------------------------------------------------------------------
+// Empty cache buffer for the caller to read a device block into.  The
+// buffer holds no block until cacheClaimed() is called.
+cache_t* SDvol::cacheClaim(bool stream) {
+#if USE_STREAM_CACHE
+  if (stream) {
+    cacheStreamBlockNumber_ = 0XFFFFFFFF;
+    return &cacheStreamBuffer_;
+  }
+#endif  // USE_STREAM_CACHE
+  if (!cacheWriteData()) {
+    DBG_FAIL_MACRO;
+    goto fail;
+  }
+  cacheStatus_ = 0;
+  cacheBlockNumber_ = 0XFFFFFFFF;
+  return &cacheBuffer_;
+
+ fail:
+  return 0;
+}
+//------------------------------------------------------------------------------
+// Record the block read into a buffer from cacheClaim().
+void SDvol::cacheClaimed(bool stream, uint32_t blockNumber) {
+#if USE_STREAM_CACHE
+  if (stream) {
+    SD_TRACE(SD_TRACE_STREAM_MISS | SD_TRACE_NO_READ | SD_TRACE_DATA,
+      blockNumber);
+    cacheStreamBlockNumber_ = blockNumber;
+    return;
+  }
+#endif  // USE_STREAM_CACHE
+  CACHE_TRACE(SD_TRACE_MISS, CACHE_OPTION_NO_READ | CACHE_OPTION_DATA,
+    blockNumber);
+  cacheBlockNumber_ = blockNumber;
+}
+#if USE_SD_TRACE
+//------------------------------------------------------------------------------
+// one dumped entry - block little endian then event
+static void tracePut(void (*put)(uint8_t b), uint32_t block, uint8_t event) {
+  for (uint8_t k = 0; k < 32; k += 8) put(block >> k);
+  put(event);
+}
+//------------------------------------------------------------------------------
+void SDvol::traceDump(void (*put)(uint8_t b)) {
+  sd_trace_index_t n = traceCount_ < SD_TRACE_SIZE ? traceCount_
+                                                    : SD_TRACE_SIZE;
+  sd_trace_index_t i = traceNext_ >= n ? traceNext_ - n
+                                       : traceNext_ + SD_TRACE_SIZE - n;
+
+  if (traceCount_ > n) tracePut(put, traceCount_ - n, SD_TRACE_LOST);
+  while (n--) {
+    tracePut(put, trace_[i].block, trace_[i].event);
+    if (++i == SD_TRACE_SIZE) i = 0;
+  }
+  traceClear();
+}
+#endif  // USE_SD_TRACE
 //------------------------------------------------------------------------------
 uint32_t SDvol::clusterStartBlock(uint32_t cluster) const {
   return dataStartBlock_ + ((cluster - 2)*blocksPerCluster_);
@@ -294,7 +492,13 @@ bool SDvol::fatGet(uint32_t cluster, uint32_t* value) {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if USE_FAT_PREFETCH
+  // cluster is the last value returned so a chain is being followed
+  pc = cluster == fatLastValue_ ? cacheFetchPrefetch(lba)
+                                : cacheFetchFat(lba, CACHE_FOR_READ);
+#else  // USE_FAT_PREFETCH
   pc = cacheFetchFat(lba, CACHE_FOR_READ);
+#endif  // USE_FAT_PREFETCH
   if (!pc) {
     DBG_FAIL_MACRO;
     goto fail;
@@ -304,6 +508,35 @@ bool SDvol::fatGet(uint32_t cluster, uint32_t* value) {
   } else {
     *value = pc->fat32[cluster & 0X7F] & FAT32MASK;
   }
+#if USE_FAT_PREFETCH
+  fatLastValue_ = *value;
+#endif  // USE_FAT_PREFETCH
+  return true;
+
+ fail:
+  return false;
+}
+//------------------------------------------------------------------------------
+// free a cluster chain
+bool SDvol::freeChain(uint32_t cluster) {
+  uint32_t next;
+
+  // clear free cluster location
+  allocSearchStart_ = 2;
+
+  do {
+    if (!fatGet(cluster, &next)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    // free cluster
+    if (!fatPut(cluster, 0)) {
+      DBG_FAIL_MACRO;
+      goto fail;
+    }
+    cluster = next;
+  } while (!isEOC(cluster));
+
   return true;
 
  fail:
@@ -360,6 +593,10 @@ bool SDvol::fatPut(uint32_t cluster, uint32_t value) {
     DBG_FAIL_MACRO;
     goto fail;
   }
+#if USE_FAT_PREFETCH
+  // prefetched copy of the block would be stale
+  cachePrefetchCount_ = 0;
+#endif  // USE_FAT_PREFETCH
   pc = cacheFetchFat(lba, CACHE_FOR_WRITE);
   if (!pc) {
     DBG_FAIL_MACRO;
@@ -378,21 +615,36 @@ bool SDvol::fatPut(uint32_t cluster, uint32_t value) {
 }
 //------------------------------------------------------------------------------
 // Initialize a FAT volume.
-bool SDvol::init(SDspi* dev, uint8_t part) {
+bool SDvol::init(SDdev* dev, uint8_t part) {
   uint32_t totalBlocks;
   uint32_t volumeStartBlock = 0;
   fat32_boot_t* fbs;
   cache_t* pc;
-  sdCard_ = dev;
+  // probe partition one then super floppy
+  bool probe = part == SD_MOUNT_AUTO;
+  dev_ = dev;
+  SD_TRACE(SD_TRACE_MOUNT, 0);
   fatType_ = 0;
   allocSearchStart_ = 2;
+  auBlocks_ = AU_UNKNOWN;
   cacheStatus_ = 0;  // cacheSync() will write block if true
   cacheBlockNumber_ = 0XFFFFFFFF;
   cacheFatOffset_ = 0;
-#if USE_SERARATEFAT_CACHE
+#if USE_SEPARATE_FAT_CACHE
   cacheFatStatus_ = 0;  // cacheSync() will write block if true
   cacheFatBlockNumber_ = 0XFFFFFFFF;
-#endif  // USE_SERARATEFAT_CACHE
+#endif  // USE_SEPARATE_FAT_CACHE
+#if USE_STREAM_CACHE
+  cacheStreamBlockNumber_ = 0XFFFFFFFF;
+#endif  // USE_STREAM_CACHE
+#if USE_DENTRY_CACHE
+  dentryClear();
+#endif  // USE_DENTRY_CACHE
+#if USE_FAT_PREFETCH
+  cachePrefetchCount_ = 0;
+  fatLastValue_ = 0;
+#endif  // USE_FAT_PREFETCH
+  if (probe) part = 1;
   // if part == 0 assume super floppy with FAT boot sector in block zero
   // if part > 0 assume mbr volume with partition table
   if (part) {
@@ -410,16 +662,25 @@ bool SDvol::init(SDspi* dev, uint8_t part) {
       p->totalSectors < 100 ||
       p->firstSector == 0) {
       // not a valid partition
-      DBG_FAIL_MACRO;
-      goto fail;
+      if (!probe) {
+        DBG_FAIL_MACRO;
+        goto fail;
+      }
+      // block zero stays in the cache for the super floppy try
+      probe = false;
+    } else {
+      volumeStartBlock = p->firstSector;
     }
-    volumeStartBlock = p->firstSector;
   }
+  SD_PROFILE(SD_STAGE_MBR);
+
+ boot:
   pc = cacheFetch(volumeStartBlock, CACHE_FOR_READ);
   if (!pc) {
     DBG_FAIL_MACRO;
     goto fail;
   }
+  SD_PROFILE(SD_STAGE_BOOT);
   fbs = &(pc->fbs32);
   if (fbs->bytesPerSector != 512 ||
     fbs->fatCount == 0 ||
@@ -477,8 +738,18 @@ bool SDvol::init(SDspi* dev, uint8_t part) {
     rootDirStart_ = fbs->fat32RootCluster;
     fatType_ = 32;
   }
+  // serial number is at a different offset in a FAT32 boot sector
+  signature_ = fatType_ == 32 ?
+    fbs->volumeSerialNumber : pc->fbs.volumeSerialNumber;
+  signature_ ^= dataStartBlock_ ^ clusterCount_;
   return true;
 
  fail:
+  // partition one is not a FAT volume - try super floppy
+  if (probe && volumeStartBlock) {
+    probe = false;
+    volumeStartBlock = 0;
+    goto boot;
+  }
   return false;
 }
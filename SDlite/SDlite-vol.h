@@ -5,9 +5,11 @@
 #ifndef SDlitevol_h
 #define SDlitevol_h
 
+#include <string.h>
 #include <SDlite-config.h>
+#include <SDlite-dev.h>
 #include <SDlite-info.h>
-#include <SDlite-SPI.h>
+class SDspi;
 
 // Cache for an SD data block
 union cache_t {
@@ -29,33 +31,153 @@ union cache_t {
   fat32_fsinfo_t fsinfo;
 };
 
+#if USE_CACHE_STATS
+/** Cache statistics.  Meta is FAT and directory blocks, data is file data. */
+struct cache_stats_t {
+  uint32_t metaLookups;
+  uint32_t metaMisses;
+  uint32_t dataLookups;
+  uint32_t dataMisses;
+};
+#endif  // USE_CACHE_STATS
+//------------------------------------------------------------------------------
+// trace events, see SDvol::traceDump() - the low nibble is the kind
+/** direct read command, block is the first block */
+uint8_t const SD_TRACE_READ = 1;
+/** direct write command, block is the first block */
+uint8_t const SD_TRACE_WRITE = 2;
+/** block is the block count of the multiple block command before */
+uint8_t const SD_TRACE_COUNT = 3;
+/** cache lookup found the block */
+uint8_t const SD_TRACE_HIT = 4;
+/** cache lookup missed and read the block unless SD_TRACE_NO_READ */
+uint8_t const SD_TRACE_MISS = 5;
+/** SDvol::cacheFetchStream() lookup found the block */
+uint8_t const SD_TRACE_STREAM_HIT = 6;
+/** SDvol::cacheFetchStream() lookup missed */
+uint8_t const SD_TRACE_STREAM_MISS = 7;
+/** fatGet() chain lookup found the block in the prefetch buffer */
+uint8_t const SD_TRACE_PREFETCH_HIT = 8;
+/** fatGet() chain lookup missed and read FAT_PREFETCH_BLOCKS blocks */
+uint8_t const SD_TRACE_PREFETCH_MISS = 9;
+/** dirty cache block written */
+uint8_t const SD_TRACE_WRITEBACK = 10;
+/** SDvol::cacheSync() called */
+uint8_t const SD_TRACE_SYNC = 11;
+/** SDvol::init() called, caches are empty */
+uint8_t const SD_TRACE_MOUNT = 12;
+/** block is the number of entries the ring dropped before a dump */
+uint8_t const SD_TRACE_LOST = 13;
+// flags in the high nibble - the cache options shifted four bits
+/** lookup for write */
+uint8_t const SD_TRACE_DIRTY = 0X10;
+/** block is in a FAT */
+uint8_t const SD_TRACE_FAT = 0X20;
+/** lookup reserves the block without reading it */
+uint8_t const SD_TRACE_NO_READ = 0X40;
+/** block is file data, not a FAT or directory block */
+uint8_t const SD_TRACE_DATA = 0X80;
+#if USE_SD_TRACE
+/** Trace entry.  Dumped as the block, little endian, then the event. */
+struct sd_trace_t {
+  uint32_t block;
+  uint8_t  event;
+};
+/** Index into the trace ring, 32 bits only for host-sized rings. */
+#if SD_TRACE_SIZE > 0XFFFF
+typedef uint32_t sd_trace_index_t;
+#else  // SD_TRACE_SIZE
+typedef uint16_t sd_trace_index_t;
+#endif  // SD_TRACE_SIZE
+#endif  // USE_SD_TRACE
+#if USE_DENTRY_CACHE
+/** Path resolved by SDfile::open().  Keyed by a hash of the path and the
+ * first cluster of the directory the search started in.
+ */
+struct dentry_t {
+  uint32_t hash;          // path hash, zero for an unused entry
+  uint32_t startCluster;  // first cluster of the start directory
+  uint32_t parentCluster; // first cluster of the directory holding the entry
+  uint32_t dirBlock;      // block holding the directory entry
+  uint32_t firstCluster;  // first cluster of the file or directory
+  uint32_t size;          // file size or directory size
+  uint8_t  dirIndex;      // index of the entry in dirBlock
+  uint8_t  isDir;         // true for a subdirectory
+};
+#endif  // USE_DENTRY_CACHE
+//------------------------------------------------------------------------------
+/** SDvol::init() partition value - try partition one then super floppy */
+uint8_t const SD_MOUNT_AUTO = 0XFF;
+//------------------------------------------------------------------------------
 class SDvol {
  public:
   /** Create an instance of SDvol */
   SDvol() : fatType_(0) {}
-  /** Initialize a FAT volume.  Try partition one first then try super
-   * floppy format.
+  /** Initialize a FAT volume.  By default try partition one first then
+   * try super floppy format.  Pass the partition, or zero for super
+   * floppy, to skip the probe when the card layout is known.
+   */
+  bool init(SDdev* dev, uint8_t part = SD_MOUNT_AUTO);
+  /** \return Allocation unit in blocks for aligned allocation or zero.
+   * The first call after init() takes SD_AU_BLOCKS or asks the device,
+   * so only volumes that log pay for the query.
+   */
+  uint32_t allocUnit() {
+    if (auBlocks_ == AU_UNKNOWN) {
+      setAllocUnit(SD_AU_BLOCKS ? SD_AU_BLOCKS : dev_->auBlocks());
+    }
+    return auBlocks_;
+  }
+  /** Set the allocation unit used by aligned allocation, zero for none.
+   * Zero is kept if no cluster of the volume starts on a unit boundary.
    */
-  bool init(SDspi* dev) { return init(dev, 1) ? true : init(dev, 0);}
-  bool init(SDspi* dev, uint8_t part);
+  void setAllocUnit(uint32_t blocks) {
+    auBlocks_ = blocks >= blocksPerCluster_
+      && dataStartBlock_ % blocksPerCluster_ ? 0 : blocks;
+  }
 
   // inline functions that return volume info
   /** The volume's cluster size in blocks. */
   uint8_t blocksPerCluster() const {return blocksPerCluster_;}
+  /** The device block of cluster two, the first data cluster. */
+  uint32_t dataStartBlock() const {return dataStartBlock_;}
   /** The FAT type of the volume. Values are 12, 16 or 32. */
   uint8_t fatType() const {return fatType_;}
   /** The number of entries in the root directory for FAT16 volumes. */
   uint32_t rootDirEntryCount() const {return rootDirEntryCount_;}
   uint32_t rootDirStart() const {return rootDirStart_;}
-  /** SDspi object for this volume
+  /** Volume serial number mixed with the volume geometry.  Used to check
+   * that a saved SDhandle belongs to this volume.
+   */
+  uint32_t signature() const {return signature_;}
+#if USE_CACHE_STATS
+  /** \return Cache statistics since the counts were last zeroed. */
+  static cache_stats_t* cacheStats() {return &cacheStats_;}
+#endif  // USE_CACHE_STATS
+#if USE_SD_TRACE
+  /** Empty the trace ring. */
+  static void traceClear() {traceNext_ = traceCount_ = 0;}
+  /** Send the trace, oldest entry first, one byte at a time to \a put
+   * then empty the ring.  Dumps taken before the ring wraps can be joined
+   * to make one trace for extras/SDtrace.cpp.
+   */
+  static void traceDump(void (*put)(uint8_t b));
+#endif  // USE_SD_TRACE
+  /** Block device for this volume
    */
-  SDspi* sdCard() {return sdCard_;}
+  SDdev* device() {return dev_;}
+  /** \deprecated Use device().  Only valid when the volume was mounted
+   * on an SDspi; defined in SDlite.h.
+   */
+  SDspi* sdCard();
 //------------------------------------------------------------------------------
  private:
   // Allow SDfile access to SDvol private data.
   friend class SDfile;
 //------------------------------------------------------------------------------
   uint32_t allocSearchStart_;   // start cluster for alloc search
+  uint32_t auBlocks_;           // allocation unit in blocks, zero or unknown
+  static uint32_t const AU_UNKNOWN = 0XFFFFFFFF;  // not asked for yet
   uint8_t blocksPerCluster_;    // cluster size in blocks
   uint32_t blocksPerFat_;       // FAT size in blocks
   uint32_t clusterCount_;       // clusters in one FAT
@@ -66,6 +188,7 @@ class SDvol {
   uint8_t fatType_;             // volume type (12, 16, OR 32)
   uint16_t rootDirEntryCount_;  // number of entries in FAT16 root dir
   uint32_t rootDirStart_;       // root start block for FAT16, cluster for FAT32
+  uint32_t signature_;          // serial number ^ geometry
 //------------------------------------------------------------------------------
 // block caches
 // use of static functions save a bit of flash - maybe not worth complexity
@@ -75,6 +198,8 @@ class SDvol {
   static const uint8_t CACHE_STATUS_MASK
      = CACHE_STATUS_DIRTY | CACHE_STATUS_FAT_BLOCK;
   static const uint8_t CACHE_OPTION_NO_READ = 4;
+  // block is file data, not FAT or directory - used for statistics
+  static const uint8_t CACHE_OPTION_DATA = 8;
   // value for option argument in cacheFetch to indicate read from cache
   static uint8_t const CACHE_FOR_READ = 0;
   // value for option argument in cacheFetch to indicate write to cache
@@ -91,19 +216,65 @@ class SDvol {
   static uint32_t cacheFatBlockNumber_;  // current Fat block number
   static uint8_t  cacheFatStatus_;       // status of cache Fatblock
 #endif  // USE_SEPARATE_FAT_CACHE
-  static SDspi* sdCard_;            // SDspi object for cache
+#if USE_STREAM_CACHE
+  static cache_t cacheStreamBuffer_;        // 512 byte cache for stream data
+  static uint32_t cacheStreamBlockNumber_;  // current stream block number
+#endif  // USE_STREAM_CACHE
+#if USE_FAT_PREFETCH
+  static cache_t cachePrefetchBuffer_[FAT_PREFETCH_BLOCKS];  // FAT blocks
+  static uint32_t cachePrefetchBlockNumber_;  // first block in buffer
+  static uint8_t cachePrefetchCount_;         // blocks in buffer
+  static uint32_t fatLastValue_;              // last value from fatGet()
+#endif  // USE_FAT_PREFETCH
+#if USE_CACHE_STATS
+  static cache_stats_t cacheStats_;
+#endif  // USE_CACHE_STATS
+#if USE_SD_TRACE
+  static sd_trace_t trace_[SD_TRACE_SIZE];
+  static sd_trace_index_t traceNext_;  // next entry to write
+  static uint32_t traceCount_;         // entries since the ring was emptied
+  static void trace(uint8_t event, uint32_t block) {
+    trace_[traceNext_].block = block;
+    trace_[traceNext_].event = event;
+    if (++traceNext_ == SD_TRACE_SIZE) traceNext_ = 0;
+    traceCount_++;
+  }
+#define SD_TRACE(event, block) trace(event, block)
+#else  // USE_SD_TRACE
+#define SD_TRACE(event, block)
+#endif  // USE_SD_TRACE
+#if USE_DENTRY_CACHE
+  static dentry_t dentry_[DENTRY_CACHE_SIZE];
+  static uint8_t dentryNext_;  // next entry to replace
+#endif  // USE_DENTRY_CACHE
+  static SDdev* dev_;               // block device for cache
 
   cache_t *cacheAddress() {return &cacheBuffer_;}
   uint32_t cacheBlockNumber() {return cacheBlockNumber_;}
 
+  static cache_t* cacheClaim(bool stream);
+  static void cacheClaimed(bool stream, uint32_t blockNumber);
   static cache_t* cacheFetch(uint32_t blockNumber, uint8_t options);
   static cache_t* cacheFetchData(uint32_t blockNumber, uint8_t options);
   static cache_t* cacheFetchFat(uint32_t blockNumber, uint8_t options);
+  cache_t* cacheFetchPrefetch(uint32_t blockNumber);
+  static cache_t* cacheFetchStream(uint32_t blockNumber);
+  static void cacheInvalidateStream(uint32_t blockNumber) {
+#if USE_STREAM_CACHE
+    if (blockNumber == cacheStreamBlockNumber_) {
+      cacheStreamBlockNumber_ = 0XFFFFFFFF;
+    }
+#endif  // USE_STREAM_CACHE
+  }
   static bool cacheSync();
+#if USE_DENTRY_CACHE
+  static void dentryClear() {memset(dentry_, 0, sizeof(dentry_));}
+#endif  // USE_DENTRY_CACHE
   static bool cacheWriteData();
   static bool cacheWriteFat();
 //------------------------------------------------------------------------------
-  bool allocContiguous(uint32_t count, uint32_t* curCluster);
+  bool allocContiguous(uint32_t count, uint32_t* curCluster,
+    bool align = false);
   uint8_t blockOfCluster(uint32_t position) const {
           return (position >> 9) & (blocksPerCluster_ - 1);}
   uint32_t clusterStartBlock(uint32_t cluster) const;
@@ -112,15 +283,52 @@ class SDvol {
   bool fatPutEOC(uint32_t cluster) {
     return fatPut(cluster, 0x0FFFFFFF);
   }
+  bool freeChain(uint32_t cluster);
   bool isEOC(uint32_t cluster) const {
     if (FAT12_SUPPORT && fatType_ == 12) return  cluster >= FAT12EOC_MIN;
     if (fatType_ == 16) return cluster >= FAT16EOC_MIN;
     return  cluster >= FAT32EOC_MIN;
   }
+#if USE_SD_TRACE
+  static void traceCommand(uint8_t event, uint32_t block, uint32_t count) {
+    SD_TRACE(event | SD_TRACE_DATA, block);
+    if (count > 1) SD_TRACE(SD_TRACE_COUNT, count);
+  }
+#else  // USE_SD_TRACE
+  static void traceCommand(uint8_t, uint32_t, uint32_t) {}
+#endif  // USE_SD_TRACE
   bool readBlock(uint32_t block, uint8_t* dst) {
-    return sdCard_->readBlock(block, dst);}
+    traceCommand(SD_TRACE_READ, block, 1);
+    return dev_->readBlock(block, dst);}
+  bool readBlocks(uint32_t block, uint8_t* dst, size_t count) {
+    traceCommand(SD_TRACE_READ, block, count);
+    return dev_->readBlocks(block, dst, count);}
+  bool readRun(uint32_t block, uint32_t count, uint8_t* buf,
+    SDrunCallback callback, void* context) {
+    traceCommand(SD_TRACE_READ, block, count);
+    return dev_->readRun(block, count, buf, callback, context);}
   bool writeBlock(uint32_t block, const uint8_t* dst) {
-    return sdCard_->writeBlock(block, dst);
+    traceCommand(SD_TRACE_WRITE, block, 1);
+    cacheDrop(block, 1);
+    return dev_->writeBlock(block, dst);
+  }
+  bool writeBlocks(uint32_t block, const uint8_t* src, size_t count) {
+    traceCommand(SD_TRACE_WRITE, block, count);
+    cacheDrop(block, count);
+    return dev_->writeBlocks(block, src, count);
+  }
+  // drop cached copies of blocks about to be written, dirty or not, so
+  // neither a read nor a later cacheSync() brings back the old data
+  static void cacheDrop(uint32_t block, size_t count) {
+    if (cacheBlockNumber_ - block < count) {
+      cacheBlockNumber_ = 0XFFFFFFFF;
+      cacheStatus_ = 0;
+    }
+#if USE_STREAM_CACHE
+    if (cacheStreamBlockNumber_ - block < count) {
+      cacheStreamBlockNumber_ = 0XFFFFFFFF;
+    }
+#endif  // USE_STREAM_CACHE
   }
 };
 #endif  // SDlite-vol_h
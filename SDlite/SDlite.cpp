@@ -4,10 +4,36 @@
 
 #include <SDlite.h>
 /**
- * Initialize an SD object.
+ * Initialize an SD object.  Pass the partition number in \a part, or zero
+ * for a super floppy card, to skip the partition probe.
  */
-bool SD::begin(uint8_t chipSelectPin, uint8_t sckRateID) {
-  return card_.init(sckRateID, chipSelectPin) && vol_.init(&card_) && chdir(1);
+bool SD::begin(uint8_t chipSelectPin, uint8_t sckRateID, uint8_t part) {
+  int8_t rtn;
+  beginStart(chipSelectPin, sckRateID, part);
+  while ((rtn = beginPoll()) == SD_POLL_BUSY) {}
+  return rtn == SD_POLL_DONE;
+}
+/**
+ * Start begin() without waiting for the card, beginPoll() finishes it.
+ */
+void SD::beginStart(uint8_t chipSelectPin, uint8_t sckRateID, uint8_t part) {
+  // the open root marks a mounted volume
+  if (vwd_.isOpen()) vwd_.close();
+  part_ = part;
+  card_.initStart(sckRateID, chipSelectPin);
+}
+/**
+ * Step the card initialization, then mount the volume and open root in
+ * the call that finds the card ready.
+ *
+ * \return SD_POLL_BUSY, SD_POLL_DONE or SD_POLL_FAIL.
+ */
+int8_t SD::beginPoll() {
+  int8_t rtn = card_.initPoll();
+  if (rtn != SD_POLL_DONE || vwd_.isOpen()) return rtn;
+  if (!vol_.init(&card_, part_) || !chdir(1)) return SD_POLL_FAIL;
+  SD_PROFILE(SD_STAGE_ROOT);
+  return SD_POLL_DONE;
 }
 /** Change a volume's working directory to root
  */
@@ -4,7 +4,9 @@
 
 #ifndef SDlite_h
 #define SDlite_h
+#include <SDlite-SPI.h>
 #include <SDlite-file.h>
+#include <SDlite-prof.h>
 //------------------------------------------------------------------------------
 /** SD version YYYYMMDD */
 #define SD_FAT_VERSION 20121219
@@ -22,7 +24,16 @@ class SD {
   bool chdir(const char* path, bool set_cwd = false);
 
   bool begin(uint8_t chipSelectPin = SD_CHIP_SELECT_PIN,
-    uint8_t sckRateID = SPI_FULL_SPEED);
+    uint8_t sckRateID = SPI_FULL_SPEED, uint8_t part = SD_MOUNT_AUTO);
+  void beginStart(uint8_t chipSelectPin = SD_CHIP_SELECT_PIN,
+    uint8_t sckRateID = SPI_FULL_SPEED, uint8_t part = SD_MOUNT_AUTO);
+  int8_t beginPoll();
+#if USE_SD_PROFILE
+  /** \return microseconds spent in startup \a stage, see SD_STAGE_CMD0. */
+  static uint32_t stageMicros(uint8_t stage) {
+    return stage ? sdStageStamp[stage] - sdStageStamp[stage - 1] : 0;
+  }
+#endif  // USE_SD_PROFILE
 
   /** \return a pointer to the SDspi object. */
   SDspi* card() {return &card_;}
@@ -35,7 +46,10 @@ class SD {
   SDspi card_;
   SDvol vol_;
   SDfile vwd_;
+  uint8_t part_;
 };
+//------------------------------------------------------------------------------
+inline SDspi* SDvol::sdCard() {return static_cast<SDspi*>(dev_);}
 
 #endif  // SDlite_h
 
@@ -0,0 +1,740 @@
+/* Host benchmark for the SDlite FAT layer
+ * James Lyden <james@lyden.org>
+ *
+ * Runs SDvol/SDfile against a card image with no SPI costs.  See
+ * SDspibench.cpp for the SPI layer on an emulated card.  Every read is
+ * checked against the file as read() returns it, blocks from extents()
+ * also against the image, and each log is read back after close.
+ *
+ * Build from the SDlite directory:
+ *   g++ -O2 -DARDUINO=105 -DUSE_CACHE_STATS=1 -Iextras/host -I. \
+ *     -o SDbench extras/SDbench.cpp \
+ *     SDlite-vol.cpp SDlite-file.cpp extras/host/Arduino.cpp
+ *
+ * Add -DUSE_SD_TRACE=1 -DSD_TRACE_SIZE=1000000 to write SDbench.trc, a
+ * trace of the slow device run for extras/SDtrace.cpp.
+ *
+ * Make a test image with, for example:
+ *   dd if=/dev/zero of=card.img bs=1M count=64 && mkfs.fat -F 16 card.img
+ *   mcopy -i card.img RTMIDI.053 ::
+ *
+ * Usage: SDbench card.img [path [lookup ...]]
+ *
+ * Each lookup path is opened repeatedly on a freshly mounted volume to
+ * time the whole open and the final directory search.  For example a deep
+ * path, or an 8.3 name against a long name in the same directory:
+ *   SDbench card.img RTMIDI.053 A/B/C/D/FILE.BIN PATCHES/PATCH~60.BIN \
+ *     "PATCHES/Grand Piano Concert.patch"
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDlite-file.h>
+#include <SDlite-ram.h>
+#include "SDimage.h"
+//------------------------------------------------------------------------------
+/**
+ * \class SDcount
+ * \brief Stacked device that counts commands and blocks moved.
+ */
+class SDcount : public SDdev {
+ public:
+  explicit SDcount(SDdev* dev) : dev_(dev) {clear();}
+  void clear() {readCmds = readBlks = writeCmds = writeBlks = 0;}
+  bool readBlock(uint32_t block, uint8_t* dst) {
+    return readBlocks(block, dst, 1);
+  }
+  bool readBlocks(uint32_t block, uint8_t* dst, size_t count) {
+    readCmds++;
+    readBlks += count;
+    return dev_->readBlocks(block, dst, count);
+  }
+  bool readRun(uint32_t block, uint32_t count, uint8_t* buf,
+    SDrunCallback callback, void* context) {
+    readCmds++;
+    readBlks += count;
+    return dev_->readRun(block, count, buf, callback, context);
+  }
+  bool writeBlock(uint32_t block, const uint8_t* src) {
+    return writeBlocks(block, src, 1);
+  }
+  bool writeBlocks(uint32_t block, const uint8_t* src, size_t count) {
+    writeCmds++;
+    writeBlks += count;
+    return dev_->writeBlocks(block, src, count);
+  }
+  bool sync() {return dev_->sync();}
+
+  uint32_t readCmds;   // device read commands
+  uint32_t readBlks;   // blocks read
+  uint32_t writeCmds;  // device write commands
+  uint32_t writeBlks;  // blocks written
+
+ private:
+  SDdev* dev_;
+};
+//------------------------------------------------------------------------------
+/**
+ * \class SDslow
+ * \brief Stacked device that adds SPI card latency to each command.
+ */
+class SDslow : public SDdev {
+ public:
+  SDslow(SDdev* dev, uint16_t cmdMicros, uint16_t blockMicros)
+    : dev_(dev), cmdMicros_(cmdMicros), blockMicros_(blockMicros) {}
+  bool readBlock(uint32_t block, uint8_t* dst) {
+    return readBlocks(block, dst, 1);
+  }
+  bool readBlocks(uint32_t block, uint8_t* dst, size_t count) {
+    delayMicroseconds(cmdMicros_ + blockMicros_*count);
+    return dev_->readBlocks(block, dst, count);
+  }
+  bool readRun(uint32_t block, uint32_t count, uint8_t* buf,
+    SDrunCallback callback, void* context) {
+    delayMicroseconds(cmdMicros_ + blockMicros_*count);
+    return dev_->readRun(block, count, buf, callback, context);
+  }
+  bool writeBlock(uint32_t block, const uint8_t* src) {
+    return writeBlocks(block, src, 1);
+  }
+  bool writeBlocks(uint32_t block, const uint8_t* src, size_t count) {
+    delayMicroseconds(cmdMicros_ + blockMicros_*count);
+    return dev_->writeBlocks(block, src, count);
+  }
+  bool sync() {return dev_->sync();}
+
+ private:
+  SDdev* dev_;
+  uint16_t cmdMicros_;
+  uint16_t blockMicros_;
+};
+//------------------------------------------------------------------------------
+/**
+ * \class SDau
+ * \brief Stacked device that models the cost of SD allocation units.
+ *
+ * Time is counted, not spent.  Like a speed class card it keeps a few
+ * allocation units open for writing.  Opening a unit part way through,
+ * or closing one that wasn't written to its end, makes the card copy the
+ * rest of the unit and costs penaltyMicros.  Writes within an open unit
+ * cost only transfer time, as do all writes below the volume's first data
+ * block since cards handle the FAT area as random access.
+ */
+class SDau : public SDdev {
+ public:
+  SDau(SDdev* dev, uint32_t auBlocks, uint16_t cmdMicros,
+    uint16_t blockMicros, uint32_t penaltyMicros)
+    : dev_(dev), auBlocks_(auBlocks), cmdMicros_(cmdMicros),
+      blockMicros_(blockMicros), penaltyMicros_(penaltyMicros),
+      randomEnd_(0), nOpen_(0) {
+    clear();
+  }
+  uint32_t auBlocks() {return auBlocks_;}
+  void clear() {micros = 0; penalties = 0;}
+  /** Writes below \a block are random access, see SDvol::dataStartBlock(). */
+  void setRandomEnd(uint32_t block) {randomEnd_ = block;}
+  /** Close all open units, as at power down. */
+  void closeAll() {
+    while (nOpen_) closeUnit(0);
+  }
+  bool readBlock(uint32_t block, uint8_t* dst) {
+    return readBlocks(block, dst, 1);
+  }
+  bool readBlocks(uint32_t block, uint8_t* dst, size_t count) {
+    micros += cmdMicros_ + (uint64_t)blockMicros_*count;
+    return dev_->readBlocks(block, dst, count);
+  }
+  bool writeBlock(uint32_t block, const uint8_t* src) {
+    return writeBlocks(block, src, 1);
+  }
+  bool writeBlocks(uint32_t block, const uint8_t* src, size_t count) {
+    micros += cmdMicros_ + (uint64_t)blockMicros_*count;
+    for (uint32_t b = block < randomEnd_ ? randomEnd_ : block;
+      b < block + count;) {
+      uint32_t end = (b/auBlocks_ + 1)*auBlocks_;
+      if (end > block + count) end = block + count;
+      write(b, end);
+      b = end;
+    }
+    return dev_->writeBlocks(block, src, count);
+  }
+  bool sync() {return dev_->sync();}
+
+  uint64_t micros;     // modeled time
+  uint32_t penalties;  // unit copies
+
+ private:
+  static const uint8_t OPEN_MAX = 4;
+  struct unit_t {
+    uint32_t au;    // unit number
+    uint32_t next;  // end of the highest block written
+  };
+  void closeUnit(uint8_t i) {
+    if (open_[i].next % auBlocks_) penalty();
+    for (nOpen_--; i < nOpen_; i++) open_[i] = open_[i + 1];
+  }
+  void penalty() {
+    micros += penaltyMicros_;
+    penalties++;
+  }
+  // write blocks [b, end) within one unit, open_[] is kept in LRU order
+  void write(uint32_t b, uint32_t end) {
+    unit_t u = {b/auBlocks_, end};
+    uint8_t i;
+    for (i = 0; i < nOpen_ && open_[i].au != u.au; i++) {}
+    if (i < nOpen_) {
+      if (open_[i].next > u.next) u.next = open_[i].next;
+      for (; i < nOpen_ - 1; i++) open_[i] = open_[i + 1];
+      nOpen_--;
+    } else {
+      if (b % auBlocks_) penalty();
+      if (nOpen_ == OPEN_MAX) closeUnit(0);
+    }
+    open_[nOpen_++] = u;
+  }
+  SDdev* dev_;
+  uint32_t auBlocks_;
+  uint16_t cmdMicros_;
+  uint16_t blockMicros_;
+  uint32_t penaltyMicros_;
+  uint32_t randomEnd_;
+  unit_t open_[OPEN_MAX];
+  uint8_t nOpen_;
+};
+//------------------------------------------------------------------------------
+static uint8_t buf[32768];
+// the bench file as read() returns it in whole blocks, what the other reads
+// are checked against, and the image for blocks read straight from a device
+static uint8_t* ref;
+static uint32_t refSize;
+static const uint8_t* imageData;
+static uint32_t dataErrors;
+//------------------------------------------------------------------------------
+// count a read that returned the wrong data, report the first
+static void wrong(const char* what) {
+  if (!dataErrors++) printf("  %s data WRONG\n", what);
+}
+// check n bytes read against what they should be
+static void check(const uint8_t* data, const uint8_t* expect, size_t n,
+  const char* what) {
+  if (memcmp(data, expect, n)) wrong(what);
+}
+//------------------------------------------------------------------------------
+// read path into ref
+static bool loadRef(SDdev* dev, const char* path) {
+  SDvol vol;
+  SDfile root;
+  SDfile file;
+  int r;
+
+  if (!vol.init(dev) || !root.openRoot(&vol)
+    || !file.open(&root, path, O_READ)) {
+    return false;
+  }
+  refSize = 0;
+  do {
+    ref = reinterpret_cast<uint8_t*>(realloc(ref, refSize + 512));
+    if (!ref) return false;
+    r = file.read(ref + refSize, 512);
+    if (r > 0) refSize += r;
+  } while (r > 0);
+  return r == 0;
+}
+//------------------------------------------------------------------------------
+// open path and read it to the end in chunks of size n
+static void readFile(SDvol* vol, SDcount* dev, const char* path, size_t n) {
+  SDfile root;
+  SDfile file;
+  unsigned long t0 = micros();
+  uint32_t total = 0;
+  int r;
+
+  dev->clear();
+  if (!root.openRoot(vol) || !file.open(&root, path, O_READ)) {
+    printf("  open %s failed\n", path);
+    return;
+  }
+  while ((r = file.read(buf, n)) > 0) {
+    if (total + r <= refSize) check(buf, ref + total, r, "read");
+    total += r;
+  }
+  file.close();
+  unsigned long us = micros() - t0;
+  if (total != refSize) wrong("read size");
+  printf("  read %-6u %8lu us %8.1f MB/s  cmds %6u  blocks %6u\n",
+    (unsigned)n, us, us ? (double)total/us : 0.0,
+    dev->readCmds, dev->readBlks);
+}
+//------------------------------------------------------------------------------
+// compare open by path with reopen from a saved SDhandle
+static void openFile(SDvol* vol, SDcount* dev, const char* path) {
+  const uint16_t N = 1000;
+  SDfile root;
+  SDfile file;
+  SDhandle handle;
+  uint8_t b;
+
+  if (!root.openRoot(vol) || !file.open(&root, path, O_READ)
+    || !file.getHandle(&handle)) {
+    printf("  open %s failed\n", path);
+    return;
+  }
+  file.close();
+  for (uint8_t byHandle = 0; byHandle < 2; byHandle++) {
+    dev->clear();
+    unsigned long t0 = micros();
+    for (uint16_t i = 0; i < N; i++) {
+      bool ok = byHandle ? file.open(vol, &handle, O_READ)
+                         : file.open(&root, path, O_READ);
+      // read a byte so the next open can't find the entry in the cache
+      if (!ok || file.read(&b, 1) != 1) {
+        printf("  open failed\n");
+        return;
+      }
+      file.close();
+    }
+    printf("  open by %-6s %6.2f us  %5.2f reads\n",
+      byHandle ? "handle" : "path", (double)(micros() - t0)/N,
+      (double)dev->readCmds/N);
+  }
+}
+//------------------------------------------------------------------------------
+// stream one file in small reads while opening another in a directory
+static void mixed(SDvol* vol, SDcount* dev, const char* path, bool stream) {
+  SDfile dir;
+  SDfile root;
+  SDfile file;
+  SDfile small;
+  uint16_t opens = 0;
+
+  if (!root.openRoot(vol) || !file.open(&root, path, O_READ)
+    || !dir.open(&root, "/BANKS/DRUMS", O_READ)) {
+    printf("  open %s failed\n", path);
+    return;
+  }
+  file.setStream(stream);
+  dev->clear();
+#if USE_CACHE_STATS
+  memset(SDvol::cacheStats(), 0, sizeof(cache_stats_t));
+#endif  // USE_CACHE_STATS
+  for (uint16_t i = 0; file.read(buf, 100) > 0; i++) {
+    if (i % 4) continue;
+    if (small.open(&dir, "KIT01.BIN", O_READ)) {
+      small.setStream(stream);
+      small.read(buf, 16);
+      small.close();
+      opens++;
+    }
+  }
+  printf("  mixed stream %-3s opens %4u  reads %5u", stream ? "on" : "off",
+    opens, dev->readCmds);
+#if USE_CACHE_STATS
+  cache_stats_t* cs = SDvol::cacheStats();
+  printf("  meta hit %5.1f%%  data hit %5.1f%%",
+    100.0 - 100.0*cs->metaMisses/cs->metaLookups,
+    100.0 - 100.0*cs->dataMisses/cs->dataLookups);
+#endif  // USE_CACHE_STATS
+  printf("\n");
+}
+//------------------------------------------------------------------------------
+// follow the whole cluster chain of path with seekEnd() from the start
+static void walk(SDvol* vol, SDcount* dev, const char* path, uint16_t N) {
+  SDfile root;
+  SDfile file;
+
+  if (!root.openRoot(vol) || !file.open(&root, path, O_READ)) {
+    printf("  open %s failed\n", path);
+    return;
+  }
+  dev->clear();
+  unsigned long t0 = micros();
+  for (uint16_t i = 0; i < N; i++) {
+    file.rewind();
+    if (!file.seekEnd()) {
+      printf("  seek failed\n");
+      return;
+    }
+  }
+  printf("  chain walk %8.2f us  %5.2f reads  %5.2f blocks\n",
+    (double)(micros() - t0)/N, (double)dev->readCmds/N,
+    (double)dev->readBlks/N);
+}
+//------------------------------------------------------------------------------
+// read path straight from the device using the runs from extents()
+static void extentRead(SDvol* vol, SDcount* dev, const char* path) {
+  const uint32_t chunk = sizeof(buf)/512;
+  SDfile root;
+  SDfile file;
+  SDextent ext[8];
+  uint32_t next = 0;
+  uint16_t runs = 0;
+  int n;
+
+  if (!root.openRoot(vol) || !file.open(&root, path, O_READ)) {
+    printf("  open %s failed\n", path);
+    return;
+  }
+  dev->clear();
+  unsigned long t0 = micros();
+  while ((n = file.extents(ext, 8, next)) > 0) {
+    for (int i = 0; i < n; i++, runs++) {
+      for (uint32_t b = 0; b < ext[i].count; b += chunk) {
+        uint32_t nb = ext[i].count - b < chunk ? ext[i].count - b : chunk;
+        uint32_t pos = 512*(next + b);
+        if (!dev->readBlocks(ext[i].block + b, buf, nb)) n = -1;
+        // the device's blocks, then the file's bytes in them
+        check(buf, imageData + 512*(ext[i].block + b), 512*nb, "extents");
+        if (pos < refSize) {
+          check(buf, ref + pos, refSize - pos < 512*nb ? refSize - pos : 512*nb,
+            "extents");
+        }
+      }
+      next += ext[i].count;
+    }
+  }
+  if (n < 0) {
+    printf("  extents failed\n");
+    return;
+  }
+  printf("  extents %4u runs %6lu us  cmds %6u  blocks %6u\n",
+    runs, micros() - t0, dev->readCmds, dev->readBlks);
+}
+//------------------------------------------------------------------------------
+// read path as records of a 12 byte header, 40 byte name and 1000 byte
+// body, eight records per pass, with one read() per field or one readv()
+static void gather(SDvol* vol, SDcount* dev, const char* path, bool vector) {
+  static const size_t field[] = {12, 40, 1000};
+  SDiovec iov[24];
+  SDfile root;
+  SDfile file;
+  uint32_t total = 0;
+  int r;
+
+  if (!root.openRoot(vol) || !file.open(&root, path, O_READ)) {
+    printf("  open %s failed\n", path);
+    return;
+  }
+  for (uint8_t i = 0, off = 0; i < 24; i++) {
+    iov[i].base = buf + 1052*(i/3) + off;
+    iov[i].len = field[i % 3];
+    off = i % 3 == 2 ? 0 : off + field[i % 3];
+  }
+  dev->clear();
+  unsigned long t0 = micros();
+  do {
+    // the fields of a pass are consecutive in buf and in the file
+    uint32_t pass = total;
+    if (vector) {
+      r = file.readv(iov, 24);
+      if (r > 0) total += r;
+    } else {
+      for (uint8_t i = 0; i < 24; i++) {
+        r = file.read(iov[i].base, iov[i].len);
+        if (r <= 0) break;
+        total += r;
+      }
+    }
+    if (total <= refSize) {
+      check(buf, ref + pass, total - pass, vector ? "readv" : "read");
+    }
+  } while (r > 0);
+  if (total != refSize) wrong(vector ? "readv size" : "read size");
+  if (r < 0) {
+    printf("  read failed\n");
+    return;
+  }
+  printf("  %-6s %7lu bytes %8lu us  cmds %6u  blocks %6u\n",
+    vector ? "readv" : "read", (unsigned long)total, micros() - t0,
+    dev->readCmds, dev->readBlks);
+}
+//------------------------------------------------------------------------------
+#if USE_LOG_MODE
+// byte pos of a log written by logRecords(), the record number then offset
+static uint8_t logByte(uint32_t pos) {return pos/64 + 7*(pos % 64);}
+//------------------------------------------------------------------------------
+// read a log back through a fresh open and check its size and bytes
+static void logCheck(SDvol* vol, const char* name, uint32_t size) {
+  SDfile root;
+  SDfile file;
+  uint32_t pos = 0;
+  int r;
+
+  if (!root.openRoot(vol) || !file.open(&root, name, O_READ)) {
+    wrong("log");
+    return;
+  }
+  while ((r = file.read(buf, sizeof(buf))) > 0) {
+    for (int i = 0; i < r; i++) {
+      if (buf[i] != logByte(pos + i)) {
+        wrong("log");
+        return;
+      }
+    }
+    pos += r;
+  }
+  if (r < 0 || pos != size) wrong("log size");
+}
+//------------------------------------------------------------------------------
+// append N 64 byte records to a new file in log mode, or with a sync()
+// after every record if syncBlocks is zero.  Amplification is blocks
+// written per block of records, including FAT and directory blocks.
+static void logRecords(SDvol* vol, SDcount* dev, const char* name,
+  uint8_t nBlocks, uint16_t syncBlocks, uint16_t N) {
+  static uint8_t logBuf[8*512];
+  SDfile root;
+  SDfile file;
+  uint8_t rec[64];
+
+  if (!root.openRoot(vol) || !file.open(&root, name, O_WRITE | O_CREAT)) {
+    printf("  create %s failed\n", name);
+    return;
+  }
+  dev->clear();
+  unsigned long t0 = micros();
+  if (!file.logBegin(logBuf, syncBlocks ? nBlocks : 1, 64UL*N,
+    syncBlocks ? syncBlocks : 1)) {
+    printf("  logBegin failed\n");
+    return;
+  }
+  for (uint16_t i = 0; i < N; i++) {
+    for (uint8_t j = 0; j < sizeof(rec); j++) rec[j] = logByte(64UL*i + j);
+    if (file.logWrite(rec, sizeof(rec)) != sizeof(rec)
+      || (!syncBlocks && !file.sync())) {
+      printf("  write failed\n");
+      return;
+    }
+  }
+  if (!file.close()) printf("  close failed\n");
+  unsigned long us = micros() - t0;
+  if (syncBlocks) {
+    printf("  log %u/%-4u", nBlocks, syncBlocks);
+  } else {
+    printf("  sync each ");
+  }
+  printf(" %9.0f records/s  writes %5u  blocks %5u  amplification %5.2f\n",
+    1e6*N/(us ? us : 1), dev->writeCmds, dev->writeBlks,
+    dev->writeBlks/(64.0*N/512));
+  logCheck(vol, name, 64UL*N);
+}
+//------------------------------------------------------------------------------
+// record nFiles log files of size bytes on a copy of an image, with a
+// power cycle after each file, using aligned allocation or not
+static void auRecord(SDimage* image, bool align, uint8_t nFiles,
+  uint32_t size) {
+  static uint8_t logBuf[8*512];
+  uint8_t* ram = reinterpret_cast<uint8_t*>(malloc(512UL*image->blockCount()));
+  if (!ram) return;
+  memcpy(ram, image->data(), 512UL*image->blockCount());
+  SDram disk(ram, image->blockCount());
+  // 4 MB units, about a 20 MHz SPI bus and 100 ms to copy a unit
+  SDau au(&disk, 8192, 100, 200, 100000);
+  SDvol vol;
+
+  if (!vol.init(&au)) {
+    printf("  mount failed\n");
+    goto done;
+  }
+  if (!align) vol.setAllocUnit(0);
+  au.setRandomEnd(vol.dataStartBlock());
+  au.clear();
+  for (uint8_t i = 0; i < nFiles; i++) {
+    char name[13];
+    SDfile root;
+    SDfile file;
+    snprintf(name, sizeof(name), "REC%02u.BIN", i);
+    if (!root.openRoot(&vol) || !file.open(&root, name, O_WRITE | O_CREAT)
+      || !file.logBegin(logBuf, 8, 1UL << 20, 256)) {
+      printf("  create %s failed\n", name);
+      goto done;
+    }
+    for (uint32_t n = 0; n < size; n += 512) {
+      if (file.logWrite(buf, 512) != 512) {
+        printf("  write failed\n");
+        goto done;
+      }
+    }
+    if (!file.close()) printf("  close failed\n");
+    au.closeAll();
+  }
+  printf("  %-9s %u x %lu KB  %6.2f MB/s  unit copies %u\n",
+    align ? "aligned" : "unaligned", nFiles, (unsigned long)size >> 10,
+    (double)nFiles*size/au.micros, au.penalties);
+
+ done:
+  free(ram);
+}
+#endif  // USE_LOG_MODE
+//------------------------------------------------------------------------------
+#if USE_READ_AHEAD
+// playback loop - read 64 bytes then poll() in idle time
+static void playback(SDvol* vol, const char* path, uint8_t raBlocks) {
+  static uint8_t ring[4*512];
+  SDfile root;
+  SDfile file;
+  uint32_t count = 0;
+  unsigned long sum = 0;
+  unsigned long worst = 0;
+
+  if (!root.openRoot(vol) || !file.open(&root, path, O_READ)
+    || !file.setReadAhead(raBlocks ? ring : 0, raBlocks)) {
+    printf("  open %s failed\n", path);
+    return;
+  }
+  file.setStream(true);
+  file.poll();
+  for (;;) {
+    unsigned long t0 = micros();
+    int r = file.read(buf, 64);
+    unsigned long us = micros() - t0;
+    if (r <= 0) break;
+    sum += us;
+    if (us > worst) worst = us;
+    count++;
+    // idle time between reads
+    file.poll();
+  }
+  printf("  read-ahead %u blocks  read() mean %6.1f us  worst %5lu us\n",
+    raBlocks, count ? (double)sum/count : 0.0, worst);
+}
+#endif  // USE_READ_AHEAD
+//------------------------------------------------------------------------------
+// time opening path on a freshly mounted volume, so the dentry cache starts
+// empty.  Loops that mount only and that also open the directory of path
+// are subtracted to give the cost of the whole open and of the final search.
+static void lookup(SDvol* vol, SDcount* dev, const char* path, uint16_t N) {
+  const char* name = strrchr(path, '/');
+  char dirPath[64] = "";
+  unsigned long us[3];
+  uint32_t reads[3];
+
+  if (name && name != path) {
+    snprintf(dirPath, sizeof(dirPath), "%.*s", (int)(name - path), path);
+  }
+  for (uint8_t step = 0; step < 3; step++) {
+    dev->clear();
+    unsigned long t0 = micros();
+    for (uint16_t i = 0; i < N; i++) {
+      SDfile root;
+      SDfile file;
+      if (!vol->init(vol->device()) || !root.openRoot(vol)
+        || (step == 1 && dirPath[0] && !file.open(&root, dirPath, O_READ))
+        || (step == 2 && !file.open(&root, path, O_READ))) {
+        printf("  open %s failed\n", path);
+        return;
+      }
+    }
+    us[step] = micros() - t0;
+    reads[step] = dev->readCmds;
+  }
+  printf("  open %8.2f us %5.2f reads  search %8.2f us %5.2f reads  %s\n",
+    ((double)us[2] - us[0])/N, ((double)reads[2] - reads[0])/N,
+    ((double)us[2] - us[1])/N, ((double)reads[2] - reads[1])/N, path);
+}
+//------------------------------------------------------------------------------
+static void run(const char* name, SDdev* raw, const char* path,
+  int nLookup, char* lookups[]) {
+  SDcount dev(raw);
+  SDvol vol;
+  unsigned long t0 = micros();
+
+  if (!vol.init(&dev)) {
+    printf("%s: mount failed\n", name);
+    return;
+  }
+  printf("%s: FAT%u mount %lu us, %u reads\n", name, vol.fatType(),
+    micros() - t0, dev.readCmds);
+  static const size_t sizes[] = {1, 32, 512, 4096, sizeof(buf)};
+  for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+    readFile(&vol, &dev, path, sizes[i]);
+  }
+  openFile(&vol, &dev, path);
+  mixed(&vol, &dev, path, false);
+  mixed(&vol, &dev, path, true);
+  walk(&vol, &dev, path, 1000);
+  extentRead(&vol, &dev, path);
+  gather(&vol, &dev, path, false);
+  gather(&vol, &dev, path, true);
+  for (int i = 0; i < nLookup; i++) lookup(&vol, &dev, lookups[i], 1000);
+}
+#if USE_SD_TRACE
+//------------------------------------------------------------------------------
+// trace of the slow device run for extras/SDtrace.cpp
+static FILE* traceFile;
+static void tracePut(uint8_t b) {putc(b, traceFile);}
+#endif  // USE_SD_TRACE
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+  SDimage image;
+  const char* path = argc > 2 ? argv[2] : "RTMIDI.053";
+
+  if (argc < 2 || !image.begin(argv[1])) {
+    fprintf(stderr, "usage: SDbench card.img [path [lookup ...]]\n");
+    return 1;
+  }
+  imageData = image.data();
+  if (!loadRef(&image, path)) {
+    fprintf(stderr, "can't read %s\n", path);
+    return 1;
+  }
+  int nLookup = argc > 3 ? argc - 3 : 0;
+  run("image", &image, path, nLookup, argv + 3);
+
+  // RAM disk copy of the same image
+  uint8_t* ram = reinterpret_cast<uint8_t*>(malloc(512UL*image.blockCount()));
+  if (!ram) return 1;
+  memcpy(ram, image.data(), 512UL*image.blockCount());
+  SDram disk(ram, image.blockCount());
+  run("ram", &disk, path, nLookup, argv + 3);
+#if USE_LOG_MODE
+  {
+    SDcount count(&disk);
+    SDvol vol;
+    if (vol.init(&count)) {
+      logRecords(&vol, &count, "SDBENCH1.LOG", 1, 0, 4096);
+      logRecords(&vol, &count, "SDBENCH2.LOG", 1, 1, 4096);
+      logRecords(&vol, &count, "SDBENCH3.LOG", 4, 64, 4096);
+      logRecords(&vol, &count, "SDBENCH4.LOG", 8, 256, 4096);
+    }
+  }
+  printf("allocation units:\n");
+  auRecord(&image, false, 4, 3UL << 20);
+  auRecord(&image, true, 4, 3UL << 20);
+  auRecord(&image, false, 3, 8UL << 20);
+  auRecord(&image, true, 3, 8UL << 20);
+#endif  // USE_LOG_MODE
+  // 200 us command latency and 1 ms per block, about a 4 MHz SPI bus
+  SDslow slow(&disk, 200, 1000);
+  SDcount count(&slow);
+  SDvol vol;
+#if USE_SD_TRACE
+  SDvol::traceClear();
+#endif  // USE_SD_TRACE
+  if (vol.init(&count)) {
+    printf("slow:\n");
+#if USE_READ_AHEAD
+    playback(&vol, path, 0);
+    playback(&vol, path, 2);
+#endif  // USE_READ_AHEAD
+    walk(&vol, &count, path, 10);
+    gather(&vol, &count, path, false);
+    gather(&vol, &count, path, true);
+    for (int i = 0; i < nLookup; i++) lookup(&vol, &count, argv[3 + i], 10);
+#if USE_LOG_MODE
+    logRecords(&vol, &count, "SDBENCH5.LOG", 1, 0, 512);
+    logRecords(&vol, &count, "SDBENCH6.LOG", 1, 1, 512);
+    logRecords(&vol, &count, "SDBENCH7.LOG", 4, 64, 512);
+    logRecords(&vol, &count, "SDBENCH8.LOG", 8, 256, 512);
+#endif  // USE_LOG_MODE
+#if USE_SD_TRACE
+    traceFile = fopen("SDbench.trc", "wb");
+    if (traceFile) {
+      SDvol::traceDump(tracePut);
+      fclose(traceFile);
+    }
+#endif  // USE_SD_TRACE
+  }
+  free(ram);
+  free(ref);
+  printf("data checks: %u errors\n", dataErrors);
+  return dataErrors ? 1 : 0;
+}
@@ -0,0 +1,406 @@
+/* Host SD card emulator for SDlite
+ * James Lyden <james@lyden.org>
+ *
+ * Answers the SD SPI protocol from a card image so SDspi, and SD::begin()
+ * above it, run unchanged on a Linux host.  Attach it to the SPI registers
+ * of the host shim with hostSpiAttach() and turn on hostVirtualTime().
+ * Each byte then costs eight SCK periods at the rate SDspi selected, and
+ * the card's latency and busy time are spent in the same clock, so a run
+ * reports what the bus and card would take rather than what the host took.
+ */
+
+#ifndef SDemu_h
+#define SDemu_h
+#include <Arduino.h>
+#include <SDlite-SPI.h>
+//------------------------------------------------------------------------------
+/**
+ * \struct SDemuTiming
+ * \brief Card timing model, all in microseconds.
+ */
+struct SDemuTiming {
+  /** ACMD41 reports idle for this long after the first ACMD41 */
+  uint32_t initMicros;
+  /** CMD17, CMD18 and ACMD13 command to first data token */
+  uint32_t readMicros;
+  /** end of one CMD18 block to the next data token */
+  uint32_t nextReadMicros;
+  /** busy after a CMD24 block */
+  uint32_t writeMicros;
+  /** busy after each CMD25 block */
+  uint32_t nextWriteMicros;
+  /** busy after the stop tran token */
+  uint32_t stopMicros;
+};
+/** No card delays, only bus time. */
+SDemuTiming const SDEMU_BUS_ONLY = {0, 0, 0, 0, 0, 0};
+/** About a class 4 card. */
+SDemuTiming const SDEMU_TYPICAL = {100000, 800, 100, 2000, 250, 1000};
+//------------------------------------------------------------------------------
+/**
+ * \class SDemu
+ * \brief SD card in SPI mode on a RAM copy of a card image.
+ *
+ * Supports CMD0, 8, 12, 13, 17, 18, 24, 25, 55, 58, 59 and ACMD13, 23, 41.
+ * Standard capacity cards take byte addresses and SDHC block addresses.
+ * CMD0 and CMD8 must carry a valid CRC.  Other CRCs are not checked.
+ */
+class SDemu : public HostSpiDev {
+ public:
+  /**
+   * Emulate a card of \a type, see SD_CARD_TYPE_SD1, on \a blockCount
+   * blocks at \a data, selected by \a csPin.
+   */
+  SDemu(uint8_t* data, uint32_t blockCount, uint8_t type,
+    uint8_t csPin = SD_CHIP_SELECT_PIN)
+    : data_(data), blockCount_(blockCount), type_(type), csPin_(csPin),
+      selected_(false), timing_(SDEMU_TYPICAL) {
+    memset(status_, 0, sizeof(status_));
+    powerUp();
+    clear();
+  }
+  /** Zero the counters. */
+  void clear() {
+    bytes = selectedBytes = waitBytes = busyBytes = 0;
+    commands = readBlks = writeBlks = 0;
+  }
+  /** Power cycle the card.  It needs 74 clocks and CMD0 again. */
+  void powerUp() {
+    powerClocks_ = cmdLen_ = respLen_ = respPos_ = 0;
+    spiMode_ = app_ = initStarted_ = false;
+    idle_ = true;
+    mode_ = MODE_IDLE;
+    busyUntil_ = 0;
+  }
+  /** Report allocation unit code \a au, see SDspi::auBlocks(). */
+  void setAuSize(uint8_t au) {status_[10] = au << 4;}
+  /** Use timing model \a timing. */
+  void setTiming(const SDemuTiming& timing) {timing_ = timing;}
+  //----------------------------------------------------------------------------
+  void pinWrite(uint8_t pin, uint8_t val) {
+    if (pin == csPin_) selected_ = val == LOW;
+  }
+  uint8_t transfer(uint8_t in) {
+    uint64_t now = hostNanos();
+    uint8_t out = 0XFF;
+
+    bytes++;
+    if (!selected_) {
+      if (powerClocks_ < 0XFF) powerClocks_++;
+      return out;
+    }
+    selectedBytes++;
+    // MISO is what the card queued before this byte
+    if (respPos_ < respLen_) {
+      out = resp_[respPos_++];
+    } else if (now < busyUntil_) {
+      out = 0;
+      busyBytes++;
+    } else if (mode_ == MODE_READ || mode_ == MODE_READ_MULTI) {
+      out = readByte(now);
+    }
+    if (mode_ == MODE_WRITE || mode_ == MODE_WRITE_MULTI) {
+      if (writeByte(in, now)) return out;
+    }
+    if (cmdLen_ || (in & 0XC0) == 0X40) {
+      cmd_[cmdLen_++] = in;
+      if (cmdLen_ == 6) {
+        cmdLen_ = 0;
+        command(now);
+      }
+    }
+    return out;
+  }
+  //----------------------------------------------------------------------------
+  /** bytes clocked */
+  uint32_t bytes;
+  /** bytes clocked with chip select low */
+  uint32_t selectedBytes;
+  /** bytes the host spent waiting for a data token */
+  uint32_t waitBytes;
+  /** bytes the host spent polling a busy card */
+  uint32_t busyBytes;
+  /** commands answered */
+  uint32_t commands;
+  /** data blocks sent in full */
+  uint32_t readBlks;
+  /** data blocks written */
+  uint32_t writeBlks;
+
+ private:
+  static uint8_t const R1_COM_CRC_ERROR = 0X08;
+  static uint8_t const R1_ADDRESS_ERROR = 0X20;
+  static uint8_t const R1_PARAMETER_ERROR = 0X40;
+  static uint8_t const DATA_RES_WRITE_ERROR = 0X0D;
+  static uint8_t const MODE_IDLE = 0;
+  static uint8_t const MODE_READ = 1;
+  static uint8_t const MODE_READ_MULTI = 2;
+  static uint8_t const MODE_WRITE = 3;
+  static uint8_t const MODE_WRITE_MULTI = 4;
+
+  uint8_t* data_;
+  uint32_t blockCount_;
+  uint8_t type_;
+  uint8_t csPin_;
+  bool selected_;
+  SDemuTiming timing_;
+  uint8_t status_[64];
+  // command state
+  uint8_t powerClocks_;
+  bool spiMode_;
+  bool idle_;
+  bool app_;
+  bool initStarted_;
+  uint64_t initDone_;
+  uint8_t cmd_[6];
+  uint8_t cmdLen_;
+  uint8_t resp_[8];
+  uint8_t respLen_;
+  uint8_t respPos_;
+  uint64_t busyUntil_;
+  // data state
+  uint8_t mode_;
+  uint32_t block_;
+  const uint8_t* src_;
+  uint16_t len_;
+  int16_t pos_;
+  uint16_t crc_;
+  uint64_t dataAt_;
+  uint8_t rx_[514];
+  //----------------------------------------------------------------------------
+  static uint8_t crc7(const uint8_t* p, uint8_t n) {
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < n; i++) {
+      uint8_t d = p[i];
+      for (uint8_t j = 0; j < 8; j++, d <<= 1) {
+        crc <<= 1;
+        if ((d ^ crc) & 0X80) crc ^= 0X09;
+      }
+    }
+    return crc & 0X7F;
+  }
+  static uint16_t crc16(const uint8_t* p, uint16_t n) {
+    uint16_t crc = 0;
+    for (uint16_t i = 0; i < n; i++) {
+      crc = (uint8_t)(crc >> 8) | (crc << 8);
+      crc ^= p[i];
+      crc ^= (uint8_t)(crc & 0XFF) >> 4;
+      crc ^= crc << 12;
+      crc ^= (crc & 0XFF) << 5;
+    }
+    return crc;
+  }
+  // queue a response with one byte of Ncr before it
+  void respond(uint8_t r1, uint32_t extra = 0, uint8_t nExtra = 0) {
+    resp_[0] = 0XFF;
+    resp_[1] = r1 | (idle_ ? R1_IDLE_STATE : 0);
+    for (uint8_t i = 0; i < nExtra; i++) {
+      resp_[2 + i] = extra >> 8*(nExtra - 1 - i);
+    }
+    respLen_ = 2 + nExtra;
+    respPos_ = 0;
+  }
+  // queue len bytes at src with the data token due at time at
+  void startRead(const uint8_t* src, uint16_t len, uint64_t at) {
+    src_ = src;
+    len_ = len;
+    crc_ = crc16(src, len);
+    // Nac is at least one byte
+    pos_ = -2;
+    dataAt_ = at;
+  }
+  uint8_t readByte(uint64_t now) {
+    if (pos_ == -2) {
+      pos_ = -1;
+      waitBytes++;
+      return 0XFF;
+    }
+    if (pos_ == -1) {
+      if (now < dataAt_) {
+        waitBytes++;
+        return 0XFF;
+      }
+      pos_ = 0;
+      return DATA_START_BLOCK;
+    }
+    if (pos_ < len_) return src_[pos_++];
+    if (pos_++ == len_) return crc_ >> 8;
+    // last CRC byte ends the block
+    uint8_t b = crc_;
+    if (len_ == 512) readBlks++;
+    if (mode_ == MODE_READ_MULTI && ++block_ < blockCount_) {
+      startRead(data_ + 512UL*block_, 512,
+        now + 1000ULL*timing_.nextReadMicros);
+    } else {
+      mode_ = MODE_IDLE;
+    }
+    return b;
+  }
+  // returns true if in was part of a write data packet
+  bool writeByte(uint8_t in, uint64_t now) {
+    if (pos_ < 0) {
+      if (in == 0XFF) return true;
+      if (mode_ == MODE_WRITE_MULTI && in == STOP_TRAN_TOKEN) {
+        mode_ = MODE_IDLE;
+        busyUntil_ = now + 1000ULL*timing_.stopMicros;
+        return true;
+      }
+      uint8_t token = mode_ == MODE_WRITE ? DATA_START_BLOCK
+        : WRITE_MULTIPLE_TOKEN;
+      if (in != token) {
+        // not a token - host gave up on the write
+        mode_ = MODE_IDLE;
+        return false;
+      }
+      pos_ = 0;
+      return true;
+    }
+    rx_[pos_++] = in;
+    if (pos_ < (int16_t)sizeof(rx_)) return true;
+    pos_ = -1;
+    resp_[0] = 0XE0 | DATA_RES_ACCEPTED;
+    respLen_ = 1;
+    respPos_ = 0;
+    if (block_ >= blockCount_) {
+      resp_[0] = 0XE0 | DATA_RES_WRITE_ERROR;
+      mode_ = MODE_IDLE;
+      return true;
+    }
+    memcpy(data_ + 512UL*block_++, rx_, 512);
+    writeBlks++;
+    if (mode_ == MODE_WRITE) {
+      mode_ = MODE_IDLE;
+      busyUntil_ = now + 1000ULL*timing_.writeMicros;
+    } else {
+      busyUntil_ = now + 1000ULL*timing_.nextWriteMicros;
+    }
+    return true;
+  }
+  // address check for data commands, returns R1 error bits
+  uint8_t address(uint32_t arg) {
+    if (type_ != SD_CARD_TYPE_SDHC) {
+      if (arg & 0X1FF) return R1_ADDRESS_ERROR;
+      arg >>= 9;
+    }
+    if (arg >= blockCount_) return R1_PARAMETER_ERROR;
+    block_ = arg;
+    return 0;
+  }
+  void command(uint64_t now) {
+    uint8_t cmd = cmd_[0] & 0X3F;
+    uint32_t arg = (uint32_t)cmd_[1] << 24 | (uint32_t)cmd_[2] << 16
+      | cmd_[3] << 8 | cmd_[4];
+    bool app = app_;
+    uint8_t r1;
+
+    app_ = false;
+    if (!spiMode_) {
+      // card in SD mode ignores all but CMD0 after power up clocks
+      if (cmd != CMD0 || powerClocks_ < 10) return;
+      spiMode_ = true;
+    }
+    commands++;
+    if ((cmd == CMD0 || cmd == CMD8) && cmd_[5] != (crc7(cmd_, 5) << 1 | 1)) {
+      respond(R1_COM_CRC_ERROR);
+      return;
+    }
+    if (cmd == CMD12) {
+      if (mode_ == MODE_READ_MULTI) mode_ = MODE_IDLE;
+      respond(R1_READY_STATE);
+      return;
+    }
+    mode_ = MODE_IDLE;
+    if (app) {
+      switch (cmd) {
+        case ACMD41:
+          // an SDHC card never leaves idle for a host without HCS
+          if (!initStarted_) {
+            initStarted_ = true;
+            initDone_ = now + 1000ULL*timing_.initMicros;
+          }
+          if (now >= initDone_ && (type_ != SD_CARD_TYPE_SDHC
+            || (arg & 0X40000000))) {
+            idle_ = false;
+          }
+          respond(R1_READY_STATE);
+          return;
+
+        case ACMD13:
+          if (idle_) break;
+          // R2 then the SD Status block
+          respond(R1_READY_STATE, 0, 1);
+          mode_ = MODE_READ;
+          startRead(status_, sizeof(status_),
+            now + 1000ULL*timing_.readMicros);
+          return;
+
+        case ACMD23:
+          if (idle_) break;
+          respond(R1_READY_STATE);
+          return;
+      }
+      respond(R1_ILLEGAL_COMMAND);
+      return;
+    }
+    switch (cmd) {
+      case CMD0:
+        idle_ = true;
+        initStarted_ = false;
+        respond(R1_READY_STATE);
+        return;
+
+      case CMD8:
+        if (type_ == SD_CARD_TYPE_SD1) break;
+        // R7 echoes voltage and check pattern
+        respond(R1_READY_STATE, arg & 0XFFF, 4);
+        return;
+
+      case CMD55:
+        app_ = true;
+        respond(R1_READY_STATE);
+        return;
+
+      case CMD58:
+        // R3 - power up status and CCS in the OCR
+        respond(R1_READY_STATE, (idle_ ? 0 : 0X80000000)
+          | (type_ == SD_CARD_TYPE_SDHC && !idle_ ? 0X40000000 : 0)
+          | 0XFF8000, 4);
+        return;
+
+      case CMD59:
+        respond(R1_READY_STATE);
+        return;
+
+      case CMD13:
+        if (idle_) break;
+        respond(R1_READY_STATE, 0, 1);
+        return;
+
+      case CMD17:
+      case CMD18:
+        if (idle_) break;
+        if ((r1 = address(arg))) {
+          respond(r1);
+          return;
+        }
+        respond(R1_READY_STATE);
+        mode_ = cmd == CMD17 ? MODE_READ : MODE_READ_MULTI;
+        startRead(data_ + 512UL*block_, 512, now + 1000ULL*timing_.readMicros);
+        return;
+
+      case CMD24:
+      case CMD25:
+        if (idle_) break;
+        if ((r1 = address(arg))) {
+          respond(r1);
+          return;
+        }
+        respond(R1_READY_STATE);
+        mode_ = cmd == CMD24 ? MODE_WRITE : MODE_WRITE_MULTI;
+        pos_ = -1;
+        return;
+    }
+    respond(R1_ILLEGAL_COMMAND);
+  }
+};
+#endif  // SDemu_h
@@ -0,0 +1,86 @@
+/* Host image file backend for SDlite
+ * James Lyden <james@lyden.org>
+ *
+ * Maps a raw card image, for example one made with dd or mkfs.fat, into
+ * memory so SDvol and SDfile can be run on a Linux host.
+ */
+
+#ifndef SDimage_h
+#define SDimage_h
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <SDlite-dev.h>
+//------------------------------------------------------------------------------
+/**
+ * \class SDimage
+ * \brief mmap backed block device for a host image file.
+ */
+class SDimage : public SDdev {
+ public:
+  SDimage() : fd_(-1), data_(0), blockCount_(0), writable_(false) {}
+  ~SDimage() {end();}
+  /** Map \a path.  \return true for success. */
+  bool begin(const char* path, bool writable = false) {
+    struct stat st;
+    end();
+    fd_ = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd_ < 0) return false;
+    if (fstat(fd_, &st) || st.st_size < 512) goto fail;
+    blockCount_ = st.st_size/512;
+    data_ = reinterpret_cast<uint8_t*>(mmap(0, 512UL*blockCount_,
+      writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd_, 0));
+    if (data_ == MAP_FAILED) {
+      data_ = 0;
+      goto fail;
+    }
+    writable_ = writable;
+    return true;
+
+   fail:
+    end();
+    return false;
+  }
+  /** Unmap the image. */
+  void end() {
+    if (data_) munmap(data_, 512UL*blockCount_);
+    if (fd_ >= 0) close(fd_);
+    data_ = 0;
+    fd_ = -1;
+    blockCount_ = 0;
+    writable_ = false;
+  }
+  /** \return The number of blocks in the image. */
+  uint32_t blockCount() const {return blockCount_;}
+  /** \return Pointer to the mapped image. */
+  uint8_t* data() {return data_;}
+  bool readBlock(uint32_t block, uint8_t* dst) {
+    return readBlocks(block, dst, 1);
+  }
+  bool readBlocks(uint32_t block, uint8_t* dst, size_t count) {
+    if (block >= blockCount_ || count > blockCount_ - block) return false;
+    memcpy(dst, data_ + 512UL*block, 512UL*count);
+    return true;
+  }
+  bool writeBlock(uint32_t block, const uint8_t* src) {
+    return writeBlocks(block, src, 1);
+  }
+  bool writeBlocks(uint32_t block, const uint8_t* src, size_t count) {
+    if (!writable_) return false;
+    if (block >= blockCount_ || count > blockCount_ - block) return false;
+    memcpy(data_ + 512UL*block, src, 512UL*count);
+    return true;
+  }
+  bool sync() {
+    return !writable_ || msync(data_, 512UL*blockCount_, MS_SYNC) == 0;
+  }
+
+ private:
+  int fd_;
+  uint8_t* data_;
+  uint32_t blockCount_;
+  bool writable_;
+};
+#endif  // SDimage_h
@@ -0,0 +1,159 @@
+/* Host SPI benchmark for SDlite
+ * James Lyden <james@lyden.org>
+ *
+ * Runs SD::begin() and SDspi against SDemu, an emulated card on a RAM copy
+ * of a card image.  Times are virtual, the SPI bus at 16 MHz F_CPU plus the
+ * card's timing model, so results repeat exactly from run to run.  Blocks
+ * read straight from the card are checked against the image.
+ *
+ * Build from the SDlite directory:
+ *   g++ -O2 -DARDUINO=105 -Iextras/host -I. -o SDspibench \
+ *     extras/SDspibench.cpp SDlite.cpp SDlite-SPI.cpp SDlite-vol.cpp \
+ *     SDlite-file.cpp extras/host/Arduino.cpp
+ *
+ * Usage: SDspibench card.img [path]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDlite.h>
+#include "SDemu.h"
+#include "SDimage.h"
+//------------------------------------------------------------------------------
+static uint8_t buf[64*512];
+static uint32_t dataErrors;
+// virtual microseconds since t0
+static double since(uint64_t t0) {return (hostNanos() - t0)/1000.0;}
+//------------------------------------------------------------------------------
+// KB/s for n blocks in us
+static double rate(uint32_t n, double us) {return us ? 500000.0*n/us : 0;}
+//------------------------------------------------------------------------------
+// check n blocks read from block against the image
+static void check(SDimage* image, uint32_t block, uint32_t n) {
+  if (!memcmp(buf, image->data() + 512*block, 512*n)) return;
+  if (!dataErrors++) printf(" data WRONG at block %u", block);
+}
+//------------------------------------------------------------------------------
+static void run(SDimage* image, const char* path, uint8_t type,
+  uint8_t sckRate, const SDemuTiming& timing, const char* label) {
+  static const char* typeName[] = {"", "SD1", "SD2", "SDHC"};
+  uint8_t* ram = reinterpret_cast<uint8_t*>(malloc(512UL*image->blockCount()));
+  if (!ram) return;
+  memcpy(ram, image->data(), 512UL*image->blockCount());
+  SDemu emu(ram, image->blockCount(), type);
+  SD sd;
+  SDfile file;
+  SDextent ext[8];
+  SDspi* card = sd.card();
+  uint32_t blocks = 0;
+  uint32_t next = 0;
+  uint32_t last = image->blockCount() - 64;
+  uint64_t t0;
+  double us;
+  int n;
+
+  emu.setTiming(timing);
+  hostSpiAttach(&emu);
+  printf("%-4s rate %2u %-8s", typeName[type], sckRate, label);
+
+  // card alone, then the whole mount on a power cycled card
+  t0 = hostNanos();
+  if (!card->init(sckRate)) {
+    printf(" card init failed %X\n", card->errorCode());
+    goto done;
+  }
+  printf(" init %6.1f ms", since(t0)/1000);
+  emu.powerUp();
+  emu.clear();
+  t0 = hostNanos();
+  if (!sd.begin(SD_CHIP_SELECT_PIN, sckRate)) {
+    printf(" begin failed %X\n", card->errorCode());
+    goto done;
+  }
+  printf(" begin %6.1f ms %6u bytes", since(t0)/1000, emu.bytes);
+
+  // file reads through the cache
+  if (!file.open(sd.vwd(), path, O_READ)) {
+    printf(" open %s failed\n", path);
+    goto done;
+  }
+  t0 = hostNanos();
+  while ((n = file.read(buf, 512)) > 0) blocks++;
+  printf("  file %6.1f", rate(blocks, since(t0)));
+
+  // the same blocks straight from the card, runs of up to 64 per readRun()
+  t0 = hostNanos();
+  while ((n = file.extents(ext, 8, next)) > 0) {
+    for (int i = 0; i < n; i++) {
+      for (uint32_t b = 0; b < ext[i].count; b += 64) {
+        uint32_t nb = ext[i].count - b < 64 ? ext[i].count - b : 64;
+        if (!card->readRun(ext[i].block + b, nb, buf)) goto fail;
+        check(image, ext[i].block + b, nb);
+      }
+      next += ext[i].count;
+    }
+  }
+  if (n < 0) goto fail;
+  printf(" run %6.1f", rate(next, since(t0)));
+  file.close();
+
+  // single and multiple block commands on the last 64 blocks
+  t0 = hostNanos();
+  for (uint8_t i = 0; i < 64; i++) {
+    if (!card->readBlock(last + i, buf + 512*i)) goto fail;
+  }
+  printf(" read %6.1f", rate(64, since(t0)));
+  check(image, last, 64);
+  t0 = hostNanos();
+  if (!card->readBlocks(last, buf, 64)) goto fail;
+  printf(" %6.1f", rate(64, since(t0)));
+  check(image, last, 64);
+  t0 = hostNanos();
+  for (uint8_t i = 0; i < 64; i++) {
+    if (!card->writeBlock(last + i, buf + 512*i)) goto fail;
+  }
+  printf(" write %6.1f", rate(64, since(t0)));
+  emu.clear();
+  t0 = hostNanos();
+  if (!card->writeBlocks(last, buf, 64)) goto fail;
+  us = since(t0);
+  printf(" %6.1f KB/s  busy %4.1f%%\n", rate(64, us),
+    100.0*emu.busyBytes/emu.selectedBytes);
+  // the blocks written back must be unchanged on the card
+  if (memcmp(ram + 512*last, image->data() + 512*last, 64*512)) {
+    if (!dataErrors++) printf("  write data WRONG\n");
+  }
+  goto done;
+
+ fail:
+  printf(" I/O error %X\n", card->errorCode());
+
+ done:
+  hostSpiAttach(0);
+  free(ram);
+}
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+  SDimage image;
+  const char* path = argc > 2 ? argv[2] : "RTMIDI.053";
+
+  if (argc < 2 || !image.begin(argv[1])) {
+    fprintf(stderr, "usage: SDspibench card.img [path]\n");
+    return 1;
+  }
+  hostVirtualTime(true);
+  printf("file, its runs by readRun(), then single and multiple block read"
+    " and write, in KB/s\n");
+  run(&image, path, SD_CARD_TYPE_SD1, SPI_FULL_SPEED, SDEMU_TYPICAL, "typical");
+  run(&image, path, SD_CARD_TYPE_SD2, SPI_FULL_SPEED, SDEMU_TYPICAL, "typical");
+  run(&image, path, SD_CARD_TYPE_SDHC, SPI_FULL_SPEED, SDEMU_TYPICAL,
+    "typical");
+  run(&image, path, SD_CARD_TYPE_SDHC, SPI_HALF_SPEED, SDEMU_TYPICAL,
+    "typical");
+  run(&image, path, SD_CARD_TYPE_SDHC, SPI_QUARTER_SPEED, SDEMU_TYPICAL,
+    "typical");
+  run(&image, path, SD_CARD_TYPE_SDHC, SPI_FULL_SPEED, SDEMU_BUS_ONLY,
+    "bus only");
+  printf("data checks: %u errors\n", dataErrors);
+  return dataErrors ? 1 : 0;
+}
@@ -0,0 +1,344 @@
+/* Cache replay tool for SDlite traces
+ * James Lyden <james@lyden.org>
+ *
+ * Reads a trace dumped by SDvol::traceDump() and replays its cache lookups
+ * against other cache layouts.  For each layout it reports the hit rate and
+ * the SD read and write commands the same run would have needed.  Direct
+ * reads and writes that bypass the cache are counted in every layout.
+ *
+ * Record a trace in a sketch built with USE_SD_TRACE, dumping it before
+ * the ring wraps:
+ *   void put(uint8_t b) {Serial.write(b);}
+ *   ...
+ *   SDvol::traceDump(put);
+ * or on the host with SDbench built with -DUSE_SD_TRACE=1, which writes
+ * SDbench.trc for its slow device run.
+ *
+ * Build from the SDlite directory:
+ *   g++ -O2 -I. -o SDtrace extras/SDtrace.cpp
+ *
+ * Usage: SDtrace trace.bin [layout ...]
+ *
+ * A layout is the number of shared cache blocks followed by options:
+ *   +f  separate one block FAT cache
+ *   +s  stream cache for SDfile::setStream() reads
+ *   +pN prefetch N FAT blocks when fatGet() follows a chain
+ * For example 1+s+p2 is the default layout on a large RAM board.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDlite-vol.h>
+//------------------------------------------------------------------------------
+struct event_t {
+  uint32_t block;
+  uint8_t event;
+};
+//------------------------------------------------------------------------------
+/**
+ * \class CacheSim
+ * \brief Block counts of one cache layout.
+ */
+class CacheSim {
+ public:
+  CacheSim(uint8_t blocks, bool fat, bool stream, uint8_t prefetch,
+    bool mirror) : nMain_(blocks), fat_(fat), stream_(stream),
+    prefetch_(prefetch), mirror_(mirror), tick_(0) {
+    lookups = hits = reads = writes = 0;
+    mount();
+  }
+  void replay(const event_t* ev, size_t n);
+
+  uint32_t lookups;
+  uint32_t hits;
+  uint32_t reads;
+  uint32_t writes;
+
+ private:
+  struct slot_t {
+    uint32_t block;
+    uint32_t used;
+    bool dirty;
+    bool fat;
+  };
+  static uint8_t const MAX_BLOCKS = 64;
+  static uint32_t const NONE = 0XFFFFFFFF;
+  slot_t main_[MAX_BLOCKS];
+  slot_t fatSlot_;
+  uint8_t nMain_;
+  bool fat_;
+  bool stream_;
+  uint8_t prefetch_;
+  bool mirror_;
+  uint32_t tick_;
+  uint32_t streamBlock_;
+  uint32_t prefetchBlock_;
+  uint8_t prefetchCount_;
+
+  slot_t* find(uint32_t block) {
+    if (fat_ && fatSlot_.block == block) return &fatSlot_;
+    for (uint8_t i = 0; i < nMain_; i++) {
+      if (main_[i].block == block) return &main_[i];
+    }
+    return 0;
+  }
+  void flush(slot_t* s) {
+    if (s->dirty) writes += s->fat && mirror_ ? 2 : 1;
+    s->dirty = false;
+  }
+  void mount() {
+    slot_t empty = {NONE, 0, false, false};
+    for (uint8_t i = 0; i < nMain_; i++) main_[i] = empty;
+    fatSlot_ = empty;
+    streamBlock_ = NONE;
+    prefetchCount_ = 0;
+  }
+  void sync() {
+    for (uint8_t i = 0; i < nMain_; i++) flush(&main_[i]);
+    flush(&fatSlot_);
+  }
+  void lookup(uint32_t block, uint8_t event);
+  void direct(uint32_t block, uint32_t count, bool write);
+};
+//------------------------------------------------------------------------------
+void CacheSim::lookup(uint32_t block, uint8_t event) {
+  bool isFat = event & SD_TRACE_FAT;
+  uint8_t kind = event & 0X0F;
+  slot_t* s;
+
+  if ((kind == SD_TRACE_STREAM_HIT || kind == SD_TRACE_STREAM_MISS)
+    && stream_) {
+    lookups++;
+    if ((s = find(block))) {
+      s->used = ++tick_;
+      hits++;
+    } else if (streamBlock_ == block) {
+      hits++;
+    } else {
+      if (!(event & SD_TRACE_NO_READ)) reads++;
+      streamBlock_ = block;
+    }
+    return;
+  }
+  if ((kind == SD_TRACE_PREFETCH_HIT || kind == SD_TRACE_PREFETCH_MISS)
+    && prefetch_) {
+    lookups++;
+    if ((s = find(block))) {
+      s->used = ++tick_;
+      hits++;
+    } else if (block - prefetchBlock_ < prefetchCount_) {
+      hits++;
+    } else {
+      // dirty FAT blocks go to the device before the prefetch read, a
+      // single shared block is written whatever it holds as in SDvol
+      for (uint8_t i = 0; i < nMain_; i++) {
+        if (main_[i].fat || (nMain_ == 1 && !fat_)) flush(&main_[i]);
+      }
+      flush(&fatSlot_);
+      reads++;
+      prefetchBlock_ = block;
+      prefetchCount_ = prefetch_;
+    }
+    return;
+  }
+  lookups++;
+  if (event & SD_TRACE_DIRTY) {
+    if (streamBlock_ == block) streamBlock_ = NONE;
+    if (isFat) prefetchCount_ = 0;
+  }
+  if (!(s = find(block))) {
+    if (fat_ && isFat) {
+      s = &fatSlot_;
+    } else {
+      // least recently used
+      s = &main_[0];
+      for (uint8_t i = 0; i < nMain_ && s->block != NONE; i++) {
+        if (main_[i].block == NONE || main_[i].used < s->used) s = &main_[i];
+      }
+    }
+    flush(s);
+    if (!(event & SD_TRACE_NO_READ)) reads++;
+    s->block = block;
+    s->fat = isFat;
+  } else {
+    hits++;
+  }
+  s->used = ++tick_;
+  if (event & SD_TRACE_DIRTY) s->dirty = true;
+}
+//------------------------------------------------------------------------------
+// direct I/O drops stale copies and counts one command
+void CacheSim::direct(uint32_t block, uint32_t count, bool write) {
+  if (!write) {
+    reads++;
+    return;
+  }
+  writes++;
+  if (streamBlock_ - block < count) streamBlock_ = NONE;
+  for (uint8_t i = 0; i < nMain_; i++) {
+    if (main_[i].block - block < count && !main_[i].dirty) {
+      main_[i].block = NONE;
+    }
+  }
+}
+//------------------------------------------------------------------------------
+void CacheSim::replay(const event_t* ev, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    uint8_t kind = ev[i].event & 0X0F;
+    uint32_t count = 1;
+    switch (kind) {
+      case SD_TRACE_READ:
+      case SD_TRACE_WRITE:
+        if (i + 1 < n && (ev[i + 1].event & 0X0F) == SD_TRACE_COUNT) {
+          count = ev[i + 1].block;
+        }
+        direct(ev[i].block, count, kind == SD_TRACE_WRITE);
+        break;
+
+      case SD_TRACE_HIT:
+      case SD_TRACE_MISS:
+      case SD_TRACE_STREAM_HIT:
+      case SD_TRACE_STREAM_MISS:
+      case SD_TRACE_PREFETCH_HIT:
+      case SD_TRACE_PREFETCH_MISS:
+        lookup(ev[i].block, ev[i].event);
+        break;
+
+      case SD_TRACE_SYNC:
+        sync();
+        break;
+
+      case SD_TRACE_MOUNT:
+        mount();
+        break;
+    }
+  }
+}
+//------------------------------------------------------------------------------
+static void report(const char* name, uint32_t lookups, uint32_t hits,
+  uint32_t reads, uint32_t writes) {
+  printf("%-12s %9u %6.2f%% %9u %9u %9u\n", name, lookups,
+    lookups ? 100.0*hits/lookups : 0.0, reads, writes, reads + writes);
+}
+//------------------------------------------------------------------------------
+// run layout spec such as 4+f+s+p2
+static bool layout(const char* spec, const event_t* ev, size_t n,
+  bool mirror) {
+  char* p;
+  uint8_t blocks = strtoul(spec, &p, 10);
+  bool fat = false;
+  bool stream = false;
+  uint8_t prefetch = 0;
+
+  while (*p == '+') {
+    if (p[1] == 'f') {
+      fat = true;
+      p += 2;
+    } else if (p[1] == 's') {
+      stream = true;
+      p += 2;
+    } else if (p[1] == 'p') {
+      prefetch = strtoul(p + 2, &p, 10);
+    } else {
+      break;
+    }
+  }
+  if (*p || blocks == 0 || blocks > 64) {
+    fprintf(stderr, "bad layout %s\n", spec);
+    return false;
+  }
+  CacheSim sim(blocks, fat, stream, prefetch, mirror);
+  sim.replay(ev, n);
+  report(spec, sim.lookups, sim.hits, sim.reads, sim.writes);
+  return true;
+}
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+  static const char* defaults[] = {
+    "1", "1+s", "1+s+p2", "1+f+s+p2", "2", "2+s+p2", "4", "4+s+p4", "8"
+  };
+  uint32_t lookups = 0;
+  uint32_t hits = 0;
+  uint32_t reads = 0;
+  uint32_t writes = 0;
+  uint32_t fatWrites = 0;
+  uint32_t mirrored = 0;
+  uint32_t lost = 0;
+  uint8_t rec[5];
+  event_t* ev = 0;
+  size_t n = 0;
+  FILE* fp;
+
+  if (argc < 2 || !(fp = fopen(argv[1], "rb"))) {
+    fprintf(stderr, "usage: SDtrace trace.bin [layout ...]\n");
+    return 1;
+  }
+  while (fread(rec, 1, sizeof(rec), fp) == sizeof(rec)) {
+    if ((n & (n - 1)) == 0) {
+      ev = reinterpret_cast<event_t*>(realloc(ev, 2*(n + 1)*sizeof(event_t)));
+      if (!ev) return 1;
+    }
+    ev[n].block = rec[0] | rec[1] << 8 | rec[2] << 16 | (uint32_t)rec[3] << 24;
+    ev[n++].event = rec[4];
+  }
+  fclose(fp);
+
+  // counts as recorded
+  for (size_t i = 0; i < n; i++) {
+    uint8_t e = ev[i].event;
+    switch (e & 0X0F) {
+      case SD_TRACE_READ:
+        reads++;
+        break;
+
+      case SD_TRACE_WRITE:
+        writes++;
+        break;
+
+      case SD_TRACE_HIT:
+      case SD_TRACE_STREAM_HIT:
+      case SD_TRACE_PREFETCH_HIT:
+        lookups++;
+        hits++;
+        break;
+
+      case SD_TRACE_MISS:
+      case SD_TRACE_STREAM_MISS:
+      case SD_TRACE_PREFETCH_MISS:
+        lookups++;
+        if (!(e & SD_TRACE_NO_READ)) reads++;
+        break;
+
+      case SD_TRACE_WRITEBACK:
+        writes++;
+        if (!(e & SD_TRACE_FAT)) break;
+        fatWrites++;
+        // the mirror copy is written right after the first FAT
+        if (i && (ev[i - 1].event & 0X0F) == SD_TRACE_WRITEBACK
+          && (ev[i - 1].event & SD_TRACE_FAT)
+          && ev[i].block > ev[i - 1].block) {
+          mirrored++;
+        }
+        break;
+
+      case SD_TRACE_LOST:
+        lost += ev[i].block;
+        break;
+    }
+  }
+  printf("%lu events", (unsigned long)n);
+  if (lost) printf(", %u lost - counts start mid-run", lost);
+  printf("\n%-12s %9s %7s %9s %9s %9s\n", "layout", "lookups", "hits",
+    "reads", "writes", "commands");
+  report("recorded", lookups, hits, reads, writes);
+  bool mirror = fatWrites == 0 || 2*mirrored == fatWrites;
+  if (argc > 2) {
+    for (int i = 2; i < argc; i++) layout(argv[i], ev, n, mirror);
+  } else {
+    for (size_t i = 0; i < sizeof(defaults)/sizeof(defaults[0]); i++) {
+      layout(defaults[i], ev, n, mirror);
+    }
+  }
+  free(ev);
+  return 0;
+}
@@ -0,0 +1,130 @@
+/* Host build shim for SDlite
+ * James Lyden <james@lyden.org>
+ */
+
+#include <time.h>
+#include <Arduino.h>
+//------------------------------------------------------------------------------
+static HostSpiDev* spiDev = 0;
+static bool virtualTime = false;
+static uint64_t virtualNanos = 0;
+static void poll();
+// digitalRead() and digitalWrite() cost about 56 cycles in the AVR core,
+// charged on the virtual clock so polling a pin lets time pass
+static void pinCost() {
+  if (virtualTime) virtualNanos += 56000000000ULL/F_CPU;
+}
+// outputs read back their last write, other pins float high unless the
+// attached SPI device drives them
+static uint8_t latch[32];  // level written plus one, zero if never written
+static int pinLevel(uint8_t pin) {
+  int val = spiDev ? spiDev->pinRead(pin) : -1;
+  if (val >= 0) return val;
+  return pin < sizeof(latch) && latch[pin] == LOW + 1 ? LOW : HIGH;
+}
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t val) {
+  pinCost();
+  if (pin < sizeof(latch)) latch[pin] = val + 1;
+  if (spiDev) spiDev->pinWrite(pin, val);
+  poll();
+}
+int digitalRead(uint8_t pin) {
+  // the port lookup comes first, the pin is sampled at the end
+  pinCost();
+  int val = pinLevel(pin);
+  poll();
+  return val;
+}
+//------------------------------------------------------------------------------
+// external interrupts INT0 and INT1 on pins 2 and 3, serviced between
+// pin accesses, SPI bytes and delay() steps
+struct isr_t {
+  void (*isr)();
+  int mode;
+  int level;
+};
+static isr_t isr[2];
+static bool enabled = true;
+static bool inIsr = false;
+void attachInterrupt(uint8_t num, void (*fn)(), int mode) {
+  if (num > 1) return;
+  isr[num].level = pinLevel(num + 2);
+  isr[num].mode = mode;
+  isr[num].isr = fn;
+}
+void detachInterrupt(uint8_t num) {
+  if (num < 2) isr[num].isr = 0;
+}
+void interrupts() {
+  enabled = true;
+  poll();
+}
+void noInterrupts() {enabled = false;}
+static void poll() {
+  if (!enabled || inIsr) return;
+  for (uint8_t i = 0; i < 2; i++) {
+    if (!isr[i].isr) continue;
+    int level = pinLevel(i + 2);
+    bool fire = level != isr[i].level && (isr[i].mode == CHANGE
+      || (isr[i].mode == RISING) == (level == HIGH));
+    isr[i].level = level;
+    if (!fire) continue;
+    // about 64 cycles of vector and attachInterrupt() dispatch
+    if (virtualTime) virtualNanos += 64000000000ULL/F_CPU;
+    inIsr = true;
+    isr[i].isr();
+    inIsr = false;
+  }
+}
+//------------------------------------------------------------------------------
+void hostVirtualTime(bool on) {virtualTime = on;}
+void hostAdvance(uint64_t ns) {virtualNanos += ns;}
+uint64_t hostNanos() {
+  struct timespec ts;
+  if (virtualTime) return virtualNanos;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+// millis() and micros() read timer0 with interrupts off, about 60 cycles,
+// so a loop polling the clock lets time pass
+static void clockCost() {
+  if (virtualTime) virtualNanos += 60000000000ULL/F_CPU;
+}
+unsigned long millis() {
+  clockCost();
+  return hostNanos()/1000000;
+}
+unsigned long micros() {
+  clockCost();
+  return hostNanos()/1000;
+}
+static void spin(uint64_t us) {
+  uint64_t t0 = hostNanos();
+  if (virtualTime) {
+    // microsecond steps so interrupts land on time
+    while (us--) {
+      hostAdvance(1000);
+      poll();
+    }
+    return;
+  }
+  while (hostNanos() - t0 < 1000*us) {}
+}
+void delay(unsigned long ms) {spin(1000ULL*ms);}
+void delayMicroseconds(unsigned int us) {spin(us);}
+//------------------------------------------------------------------------------
+HostSpiData SPDR;
+uint8_t SPCR;
+uint8_t SPSR;
+void hostSpiAttach(HostSpiDev* dev) {spiDev = dev;}
+HostSpiData& HostSpiData::operator=(uint8_t b) {
+  // F_CPU divisor 4, 16, 64 or 128 from SPR1:SPR0, halved by SPI2X
+  uint16_t div = (SPCR & 3) == 3 ? 128 : 4 << 2*(SPCR & 3);
+  if (SPSR & (1 << SPI2X)) div >>= 1;
+  hostAdvance(8000000000ULL*div/F_CPU);
+  rx_ = spiDev ? spiDev->transfer(b) : 0XFF;
+  SPSR |= 1 << SPIF;
+  poll();
+  return *this;
+}
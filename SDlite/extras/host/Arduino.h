@@ -0,0 +1,137 @@
+/* Host build shim for SDlite
+ * James Lyden <james@lyden.org>
+ *
+ * Just enough of the Arduino core to compile the FAT layer on a Linux
+ * host for benchmarks and tools in extras/.  Not used by the IDE.
+ */
+
+#ifndef Arduino_h
+#define Arduino_h
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif  // F_CPU
+
+#define HIGH 0X1
+#define LOW  0X0
+#define INPUT 0X0
+#define OUTPUT 0X1
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+// from avr/sfr_defs.h
+#define _BV(bit) (1 << (bit))
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+// default SPI pins of an ATmega328
+uint8_t const SS = 10;
+uint8_t const MOSI = 11;
+uint8_t const MISO = 12;
+uint8_t const SCK = 13;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void attachInterrupt(uint8_t num, void (*isr)(), int mode);
+void detachInterrupt(uint8_t num);
+void interrupts();
+void noInterrupts();
+//------------------------------------------------------------------------------
+// virtual time for emulated devices, see SDemu.h
+/**
+ * Run millis(), micros() and delay() on a clock moved by hostAdvance().
+ * SPI bytes, clock reads and digitalRead() or digitalWrite() calls also
+ * move it.
+ */
+void hostVirtualTime(bool on);
+/** \return Nanoseconds of virtual time, or of the host clock if not on. */
+uint64_t hostNanos();
+/** Advance virtual time by \a ns nanoseconds. */
+void hostAdvance(uint64_t ns);
+//------------------------------------------------------------------------------
+/**
+ * \class HostSpiDev
+ * \brief Device on the host SPI bus, see hostSpiAttach().
+ */
+class HostSpiDev {
+ public:
+  /** \return The byte shifted out by the device while \a b is shifted in. */
+  virtual uint8_t transfer(uint8_t b) = 0;
+  /** Called by digitalWrite() so the device can watch its chip select. */
+  virtual void pinWrite(uint8_t pin, uint8_t val) {}
+  /** \return Level the device drives on \a pin, or -1 if it does not. */
+  virtual int pinRead(uint8_t pin) {return -1;}
+};
+/** Attach \a dev to the SPI registers, zero to detach. */
+void hostSpiAttach(HostSpiDev* dev);
+/**
+ * \class HostSpiBus
+ * \brief Several devices on one bus, each watching its own chip select.
+ *
+ * Deselected devices must answer 0XFF so MISO is the selected device.
+ */
+class HostSpiBus : public HostSpiDev {
+ public:
+  HostSpiBus() : count_(0) {}
+  /** Add \a dev to the bus. */
+  void add(HostSpiDev* dev) {
+    if (count_ < MAX_DEVS) dev_[count_++] = dev;
+  }
+  uint8_t transfer(uint8_t b) {
+    uint8_t out = 0XFF;
+    for (uint8_t i = 0; i < count_; i++) out &= dev_[i]->transfer(b);
+    return out;
+  }
+  void pinWrite(uint8_t pin, uint8_t val) {
+    for (uint8_t i = 0; i < count_; i++) dev_[i]->pinWrite(pin, val);
+  }
+  int pinRead(uint8_t pin) {
+    for (uint8_t i = 0; i < count_; i++) {
+      int val = dev_[i]->pinRead(pin);
+      if (val >= 0) return val;
+    }
+    return -1;
+  }
+
+ private:
+  static uint8_t const MAX_DEVS = 8;
+  HostSpiDev* dev_[MAX_DEVS];
+  uint8_t count_;
+};
+//------------------------------------------------------------------------------
+// ATmega328 SPI registers.  Writing SPDR clocks one byte through the attached
+// device and advances virtual time by eight SCK periods.
+/** SPI data register */
+class HostSpiData {
+ public:
+  HostSpiData& operator=(uint8_t b);
+  operator uint8_t() const {return rx_;}
+ private:
+  uint8_t rx_;
+};
+extern HostSpiData SPDR;
+extern uint8_t SPCR;
+extern uint8_t SPSR;
+#define SPR0 0
+#define SPR1 1
+#define CPHA 2
+#define CPOL 3
+#define MSTR 4
+#define DORD 5
+#define SPE 6
+#define SPIE 7
+#define SPI2X 0
+#define SPIF 7
+#endif  // Arduino_h